@@ -0,0 +1,615 @@
+// This file is part of utm.
+
+// (c) Copyright 2019 Miguel Aguiar.
+//
+// This program is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option) any
+// later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU Lesser General Public License for more details.
+
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+// Benchmark of the conversion routines.
+//
+// Every kernel is run on every input distribution and reported in points per
+// second.  On Linux the hardware performance counters are read around each
+// run with perf_event_open(2); counters which cannot be opened (no PMU in a
+// virtual machine, perf_event_paranoid too strict, ...) are reported as "-"
+// and the timings are still printed.  Cache and branch misses are reported
+// per thousand points.
+//
+// The static-skew and steal-skew kernels compare static partitioning with the
+// work-stealing scheduler on a skewed workload: the points are cut into tasks
+// mixing forward and inverse conversions, and the tasks in the first sixteenth
+// of the input are converted 64 times over, as densified geometries would be.
+// They use -t threads (default: one per processor); counters only cover the
+// calling thread.
+//
+// With -s rate, shadow accuracy sampling of one in rate points is enabled
+// during the runs and its counters are printed at the end.  With -a 1, the
+// meridian arc and footpoint latitude series are interpolated from tables.
+//
+// Usage: bench [-n points] [-r repetitions] [-k kernel] [-d distribution]
+// 	[-t threads] [-s rate] [-a tables]
+
+#define _GNU_SOURCE
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "utm/buffer.h"
+#include "utm/sched.h"
+#include "utm/shadow.h"
+#include "utm/utm.h"
+
+/* Hardware counters */
+
+enum {
+	CNT_CYCLES,
+	CNT_INSTRUCTIONS,
+	CNT_L1D_MISSES,
+	CNT_LLC_MISSES,
+	CNT_BRANCH_MISSES,
+	CNT_COUNT
+};
+
+static char const *const counter_names[CNT_COUNT] = {
+    "cycles", "instr", "L1D-miss", "LLC-miss", "br-miss"};
+
+struct counters {
+	int fd[CNT_COUNT];
+	double value[CNT_COUNT]; /* Scaled count, or NAN if unavailable */
+};
+
+#ifdef __linux__
+static int open_counter(uint32_t type, uint64_t config)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof attr);
+	attr.size = sizeof attr;
+	attr.type = type;
+	attr.config = config;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format =
+	    PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+	return (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+#endif
+
+static void counters_open(struct counters *c)
+{
+	for (int i = 0; i < CNT_COUNT; ++i)
+		c->fd[i] = -1;
+
+#ifdef __linux__
+	uint64_t const l1d = PERF_COUNT_HW_CACHE_L1D |
+			     (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+			     (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+
+	c->fd[CNT_CYCLES] =
+	    open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+	c->fd[CNT_INSTRUCTIONS] =
+	    open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+	c->fd[CNT_L1D_MISSES] = open_counter(PERF_TYPE_HW_CACHE, l1d);
+	c->fd[CNT_LLC_MISSES] =
+	    open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+	c->fd[CNT_BRANCH_MISSES] =
+	    open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+#endif
+}
+
+static int counters_available(struct counters const *c)
+{
+	for (int i = 0; i < CNT_COUNT; ++i)
+		if (c->fd[i] >= 0)
+			return 1;
+
+	return 0;
+}
+
+static void counters_start(struct counters *c)
+{
+#ifdef __linux__
+	for (int i = 0; i < CNT_COUNT; ++i) {
+		if (c->fd[i] < 0)
+			continue;
+		ioctl(c->fd[i], PERF_EVENT_IOC_RESET, 0);
+		ioctl(c->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+	}
+#else
+	(void)c;
+#endif
+}
+
+// Stops the counters and stores their values, scaled up if the kernel had to
+// multiplex them.
+static void counters_stop(struct counters *c)
+{
+	for (int i = 0; i < CNT_COUNT; ++i) {
+		c->value[i] = NAN;
+
+#ifdef __linux__
+		uint64_t buf[3]; /* value, time enabled, time running */
+
+		if (c->fd[i] < 0)
+			continue;
+
+		ioctl(c->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+		if (read(c->fd[i], buf, sizeof buf) != (ssize_t)sizeof buf ||
+		    buf[2] == 0)
+			continue;
+
+		c->value[i] = (double)buf[0] * ((double)buf[1] / buf[2]);
+#endif
+	}
+}
+
+static void counters_close(struct counters *c)
+{
+#ifdef __linux__
+	for (int i = 0; i < CNT_COUNT; ++i)
+		if (c->fd[i] >= 0)
+			close(c->fd[i]);
+#else
+	(void)c;
+#endif
+}
+
+/* Input distributions */
+
+struct points {
+	size_t n;
+	double *lat, *lon;	   /* Geographic input */
+	double *x, *y;		   /* Projected output / inverse input */
+	int *zones;
+	int zone;		   /* Zone of the inverse input */
+};
+
+// Uniform pseudo-random number in [0, 1); the benchmark must be reproducible,
+// so use a fixed generator instead of rand().
+static double uniform(uint64_t *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+
+	return (double)(*state >> 11) / 9007199254740992.0;
+}
+
+static void gen_global(struct points *p, uint64_t *s)
+{
+	for (size_t i = 0; i < p->n; ++i) {
+		p->lat[i] = -80.0 + 164.0 * uniform(s);
+		p->lon[i] = -180.0 + 360.0 * uniform(s);
+	}
+}
+
+static void gen_zone(struct points *p, uint64_t *s)
+{
+	for (size_t i = 0; i < p->n; ++i) {
+		p->lat[i] = 36.0 + 8.0 * uniform(s);
+		p->lon[i] = -9.0 + 6.0 * uniform(s);
+	}
+}
+
+// Points within 0.05 degrees of a zone boundary, so that consecutive points
+// alternate between zones.
+static void gen_seam(struct points *p, uint64_t *s)
+{
+	for (size_t i = 0; i < p->n; ++i) {
+		double const seam = -174.0 + 6.0 * floor(58.0 * uniform(s));
+
+		p->lat[i] = -60.0 + 120.0 * uniform(s);
+		p->lon[i] = seam + 0.1 * (uniform(s) - 0.5);
+	}
+}
+
+static void gen_polar(struct points *p, uint64_t *s)
+{
+	for (size_t i = 0; i < p->n; ++i) {
+		p->lat[i] = 70.0 + 14.0 * uniform(s);
+		p->lon[i] = 18.0 + 6.0 * uniform(s);
+	}
+}
+
+static struct {
+	char const *name;
+	void (*gen)(struct points *, uint64_t *);
+} const distributions[] = {
+    {"global", gen_global},
+    {"zone", gen_zone},
+    {"seam", gen_seam},
+    {"polar", gen_polar},
+};
+
+/* Kernels */
+
+static void run_scalar_fwd(struct points *p)
+{
+	for (size_t i = 0; i < p->n; ++i)
+		p->zones[i] = lat_lon_to_utm(
+		    p->lat[i], p->lon[i], NULL, &p->x[i], &p->y[i]);
+}
+
+static void run_scalar_inv(struct points *p)
+{
+	for (size_t i = 0; i < p->n; ++i)
+		utm_to_lat_lon(
+		    p->x[i], p->y[i], p->zone, 0, &p->lat[i], &p->lon[i]);
+}
+
+static void run_batch_fwd(struct points *p)
+{
+	lat_lon_to_utm_batch(
+	    p->n, p->lat, p->lon, NULL, p->x, p->y, p->zones);
+}
+
+static void run_batch_fwd_dd(struct points *p)
+{
+	lat_lon_to_utm_batch_dd(
+	    p->n, p->lat, p->lon, NULL, p->x, p->y, p->zones);
+}
+
+static void run_batch_inv(struct points *p)
+{
+	utm_to_lat_lon_batch(p->n, p->x, p->y, p->zone, 0, p->lat, p->lon);
+}
+
+/* Aligned point buffer, holding a copy of the inputs of the kernels */
+static struct utm_point_buffer pbuf;
+
+static void run_buffer_fwd(struct points *p)
+{
+	(void)p;
+	utm_point_buffer_forward(&pbuf, NULL);
+}
+
+static void run_buffer_inv(struct points *p)
+{
+	utm_point_buffer_inverse(&pbuf, p->zone, 0);
+}
+
+/* Copy of the inputs in the blocked layout, and its output */
+static double *aosoa_in, *aosoa_out;
+
+static void run_aosoa_fwd(struct points *p)
+{
+	lat_lon_to_utm_batch_aosoa(p->n, aosoa_in, NULL, aosoa_out, p->zones);
+}
+
+static void run_aosoa_inv(struct points *p)
+{
+	utm_to_lat_lon_batch_aosoa(p->n, aosoa_in, p->zone, 0, aosoa_out);
+}
+
+/* Skewed workload */
+
+#define SKEW_TASK 256	  /* Points per task */
+#define SKEW_HEAVY 64	  /* Repetitions of a heavy task */
+
+static int nthreads;
+static struct utm_sched *sched;
+
+// Runs tasks [begin, end) of the skewed workload.  Odd tasks are inverse
+// conversions of the output of a forward conversion of the points, which is
+// enough to make their cost differ from the even ones.
+static void skew_tasks(void *arg, size_t begin, size_t end)
+{
+	struct points *p = arg;
+	size_t const ntasks = (p->n + SKEW_TASK - 1) / SKEW_TASK;
+
+	for (size_t t = begin; t < end; ++t) {
+		size_t const first = t * SKEW_TASK;
+		size_t const cnt =
+		    p->n - first < SKEW_TASK ? p->n - first : SKEW_TASK;
+		int const reps = t < ntasks / 16 ? SKEW_HEAVY : 1;
+
+		for (int r = 0; r < reps; ++r) {
+			if (t % 2)
+				utm_to_lat_lon_batch(cnt,
+						     p->x + first,
+						     p->y + first,
+						     p->zone,
+						     0,
+						     p->lat + first,
+						     p->lon + first);
+			else
+				lat_lon_to_utm_batch(cnt,
+						     p->lat + first,
+						     p->lon + first,
+						     &p->zone,
+						     p->x + first,
+						     p->y + first,
+						     NULL);
+		}
+	}
+}
+
+struct static_part {
+	pthread_t thread;
+	struct points *p;
+	size_t begin, end;
+};
+
+static void *static_main(void *arg)
+{
+	struct static_part *part = arg;
+
+	skew_tasks(part->p, part->begin, part->end);
+	return NULL;
+}
+
+// Splits the tasks in equal contiguous parts, one per thread, as a parallel
+// loop with a static schedule does.
+static void run_static_skew(struct points *p)
+{
+	size_t const ntasks = (p->n + SKEW_TASK - 1) / SKEW_TASK;
+	struct static_part part[nthreads];
+
+	for (int i = 0; i < nthreads; ++i) {
+		part[i].p = p;
+		part[i].begin = ntasks * (size_t)i / (size_t)nthreads;
+		part[i].end = ntasks * (size_t)(i + 1) / (size_t)nthreads;
+		if (i > 0)
+			pthread_create(&part[i].thread, NULL, static_main,
+				       &part[i]);
+	}
+
+	static_main(&part[0]);
+
+	for (int i = 1; i < nthreads; ++i)
+		pthread_join(part[i].thread, NULL);
+}
+
+static void run_steal_skew(struct points *p)
+{
+	size_t const ntasks = (p->n + SKEW_TASK - 1) / SKEW_TASK;
+
+	utm_sched_parallel_for(sched, ntasks, 1, skew_tasks, p);
+}
+
+static struct {
+	char const *name;
+	int inverse;
+	void (*run)(struct points *);
+} const kernels[] = {
+    {"scalar-fwd", 0, run_scalar_fwd},
+    {"scalar-inv", 1, run_scalar_inv},
+    {"batch-fwd", 0, run_batch_fwd},
+    {"batch-inv", 1, run_batch_inv},
+    {"batch-fwd-dd", 0, run_batch_fwd_dd},
+    {"buffer-fwd", 0, run_buffer_fwd},
+    {"buffer-inv", 1, run_buffer_inv},
+    {"aosoa-fwd", 0, run_aosoa_fwd},
+    {"aosoa-inv", 1, run_aosoa_inv},
+    {"static-skew", 1, run_static_skew},
+    {"steal-skew", 1, run_steal_skew},
+};
+
+#define ARRAY_LEN(a) (sizeof(a) / sizeof(*(a)))
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + 1e-9 * (double)ts.tv_nsec;
+}
+
+// Regenerates the inputs of the kernel.  Inverse kernels take projected
+// points of a single zone, so the geographic points are first projected into
+// the zone of the first point.  The inputs are also copied into the point
+// buffer and the blocked array for the buffer and aosoa kernels.
+static void prepare(struct points *p, size_t dist, int inverse)
+{
+	uint64_t state = 0x9E3779B97F4A7C15ull;
+
+	distributions[dist].gen(p, &state);
+
+	if (inverse) {
+		p->zone = (int)floor((p->lon[0] + 180.0) / 6.0) + 1;
+		lat_lon_to_utm_batch(
+		    p->n, p->lat, p->lon, &p->zone, p->x, p->y, NULL);
+	}
+
+	memcpy(pbuf.lat, p->lat, p->n * sizeof(double));
+	memcpy(pbuf.lon, p->lon, p->n * sizeof(double));
+	memcpy(pbuf.easting, p->x, p->n * sizeof(double));
+	memcpy(pbuf.northing, p->y, p->n * sizeof(double));
+
+	for (size_t i = 0; i < p->n; ++i) {
+		size_t const b = i / UTM_AOSOA_BLOCK * 2 * UTM_AOSOA_BLOCK;
+		size_t const lane = i % UTM_AOSOA_BLOCK;
+
+		aosoa_in[b + lane] = inverse ? p->x[i] : p->lat[i];
+		aosoa_in[b + UTM_AOSOA_BLOCK + lane] =
+		    inverse ? p->y[i] : p->lon[i];
+	}
+}
+
+static void print_value(double v, char const *fmt)
+{
+	if (isnan(v))
+		printf(" %9s", "-");
+	else
+		printf(fmt, v);
+}
+
+static void usage(char const *argv0)
+{
+	fprintf(stderr,
+		"usage: %s [-n points] [-r repetitions] [-k kernel] "
+		"[-d distribution] [-t threads] [-s rate] [-a tables]\n",
+		argv0);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+	size_t n = 1000000;
+	int reps = 5;
+	char const *kfilter = NULL, *dfilter = NULL;
+	unsigned long shadow_rate = 0;
+
+	for (int i = 1; i < argc; ++i) {
+		if (i + 1 >= argc)
+			usage(argv[0]);
+
+		if (!strcmp(argv[i], "-n"))
+			n = strtoul(argv[++i], NULL, 10);
+		else if (!strcmp(argv[i], "-r"))
+			reps = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-k"))
+			kfilter = argv[++i];
+		else if (!strcmp(argv[i], "-d"))
+			dfilter = argv[++i];
+		else if (!strcmp(argv[i], "-t"))
+			nthreads = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-s"))
+			shadow_rate = strtoul(argv[++i], NULL, 10);
+		else if (!strcmp(argv[i], "-a"))
+			utm_set_arc_tables(atoi(argv[++i]));
+		else
+			usage(argv[0]);
+	}
+
+	if (n == 0 || reps < 1 || nthreads < 0)
+		usage(argv[0]);
+
+	sched = utm_sched_create(nthreads);
+	if (!sched) {
+		fprintf(stderr, "cannot create the scheduler\n");
+		return EXIT_FAILURE;
+	}
+	nthreads = utm_sched_threads(sched);
+
+	if (shadow_rate && utm_shadow_start(shadow_rate)) {
+		fprintf(stderr, "cannot start shadow sampling\n");
+		return EXIT_FAILURE;
+	}
+
+	struct points p = {n,
+			   malloc(n * sizeof(double)),
+			   malloc(n * sizeof(double)),
+			   malloc(n * sizeof(double)),
+			   malloc(n * sizeof(double)),
+			   malloc(n * sizeof(int)),
+			   0};
+
+	size_t const nblocks = (n + UTM_AOSOA_BLOCK - 1) / UTM_AOSOA_BLOCK;
+	aosoa_in = malloc(nblocks * 2 * UTM_AOSOA_BLOCK * sizeof(double));
+	aosoa_out = malloc(nblocks * 2 * UTM_AOSOA_BLOCK * sizeof(double));
+
+	if (!p.lat || !p.lon || !p.x || !p.y || !p.zones || !aosoa_in ||
+	    !aosoa_out ||
+	    utm_point_buffer_init(&pbuf, n, UTM_BUFFER_HUGE_PAGES)) {
+		fprintf(stderr, "out of memory\n");
+		return EXIT_FAILURE;
+	}
+
+	struct counters cnt;
+	counters_open(&cnt);
+
+	if (!counters_available(&cnt))
+		fprintf(stderr,
+			"hardware counters unavailable, "
+			"reporting timings only\n");
+
+	printf("%-12s %-7s %9s %9s %9s", "kernel", "dist", "Mpts/s", "cyc/pt",
+	       "IPC");
+	for (int i = CNT_L1D_MISSES; i < CNT_COUNT; ++i)
+		printf(" %9s", counter_names[i]);
+	printf("\n");
+
+	for (size_t k = 0; k < ARRAY_LEN(kernels); ++k) {
+		if (kfilter && strcmp(kfilter, kernels[k].name))
+			continue;
+
+		for (size_t d = 0; d < ARRAY_LEN(distributions); ++d) {
+			if (dfilter && strcmp(dfilter, distributions[d].name))
+				continue;
+
+			double best = INFINITY;
+			double val[CNT_COUNT] = {0};
+
+			/* Keep the counters of the fastest repetition. */
+			for (int r = 0; r < reps; ++r) {
+				prepare(&p, d, kernels[k].inverse);
+
+				counters_start(&cnt);
+				double const t0 = now();
+				kernels[k].run(&p);
+				double const t = now() - t0;
+				counters_stop(&cnt);
+
+				if (t < best) {
+					best = t;
+					memcpy(val, cnt.value, sizeof val);
+				}
+			}
+
+			printf("%-12s %-7s %9.2f",
+			       kernels[k].name,
+			       distributions[d].name,
+			       1e-6 * (double)n / best);
+			print_value(val[CNT_CYCLES] / (double)n, " %9.1f");
+			print_value(val[CNT_INSTRUCTIONS] / val[CNT_CYCLES],
+				    " %9.2f");
+
+			/* Misses per thousand points */
+			for (int i = CNT_L1D_MISSES; i < CNT_COUNT; ++i)
+				print_value(1e3 * val[i] / (double)n, " %9.2f");
+			printf("\n");
+		}
+	}
+
+	counters_close(&cnt);
+	utm_sched_destroy(sched);
+
+	if (shadow_rate) {
+		struct utm_shadow_stats st;
+
+		utm_shadow_stop();
+		utm_shadow_snapshot(&st);
+		printf("shadow: %llu samples, %llu dropped, max %.3g m "
+		       "(%.6f, %.6f), rms %.3g m\n",
+		       st.samples,
+		       st.dropped,
+		       st.max_error,
+		       st.max_lat,
+		       st.max_lon,
+		       st.rms_error);
+	}
+
+	free(p.lat);
+	free(p.lon);
+	free(p.x);
+	free(p.y);
+	free(p.zones);
+	utm_point_buffer_free(&pbuf);
+	free(aosoa_in);
+	free(aosoa_out);
+
+	return EXIT_SUCCESS;
+}
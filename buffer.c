@@ -0,0 +1,105 @@
+// This file is part of utm.
+
+// (c) Copyright 2019 Miguel Aguiar.
+//
+// This program is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option) any
+// later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU Lesser General Public License for more details.
+
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#define _DEFAULT_SOURCE
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "utm/buffer.h"
+
+// Size of a huge page on the usual systems; mappings of at least this size
+// are worth asking huge pages for.
+#define HUGE_PAGE_SIZE ((size_t)2 << 20)
+
+int utm_point_buffer_init(struct utm_point_buffer *buf, size_t n, int flags)
+{
+	if (!buf)
+		return -1;
+
+	memset(buf, 0, sizeof *buf);
+
+	size_t const cap =
+	    (n + UTM_BUFFER_PAD - 1) / UTM_BUFFER_PAD * UTM_BUFFER_PAD;
+	if (cap < n || cap > SIZE_MAX / (4 * sizeof(double) + sizeof(int)))
+		return -1;
+
+	size_t const dbytes = cap * sizeof(double);
+	size_t const bytes = 4 * dbytes + cap * sizeof(int);
+	void *block = NULL;
+
+	if (bytes == 0)
+		return 0;
+
+#ifdef MADV_HUGEPAGE
+	if ((flags & UTM_BUFFER_HUGE_PAGES) && bytes >= HUGE_PAGE_SIZE) {
+		size_t const len = (bytes + HUGE_PAGE_SIZE - 1) /
+				   HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+
+		block = mmap(NULL,
+			     len,
+			     PROT_READ | PROT_WRITE,
+			     MAP_PRIVATE | MAP_ANONYMOUS,
+			     -1,
+			     0);
+		if (block == MAP_FAILED) {
+			block = NULL;
+		} else {
+			/* Transparent huge pages; failure is harmless. */
+			madvise(block, len, MADV_HUGEPAGE);
+			buf->mapped = 1;
+			buf->bytes = len;
+		}
+	}
+#else
+	(void)flags;
+#endif
+
+	if (!block) {
+		if (posix_memalign(&block, UTM_BUFFER_ALIGN, bytes))
+			return -1;
+		memset(block, 0, bytes);
+		buf->bytes = bytes;
+	}
+
+	char *p = block;
+
+	buf->block = block;
+	buf->n = n;
+	buf->capacity = cap;
+	buf->lat = (double *)p;
+	buf->lon = (double *)(p + dbytes);
+	buf->easting = (double *)(p + 2 * dbytes);
+	buf->northing = (double *)(p + 3 * dbytes);
+	buf->zone = (int *)(p + 4 * dbytes);
+
+	return 0;
+}
+
+void utm_point_buffer_free(struct utm_point_buffer *buf)
+{
+	if (!buf)
+		return;
+
+	if (buf->mapped)
+		munmap(buf->block, buf->bytes);
+	else
+		free(buf->block);
+
+	memset(buf, 0, sizeof *buf);
+}
@@ -0,0 +1,111 @@
+// This file is part of utm.
+
+// (c) Copyright 2019 Miguel Aguiar.
+//
+// This program is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option) any
+// later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU Lesser General Public License for more details.
+
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+// Converts the files of a manifest with utm_run_manifest.  Running it again
+// with the same journal after an interruption resumes the conversion from the
+// last committed chunk of every file.
+//
+// With --tune, the conversion routines are timed on this host instead and the
+// fastest configuration is saved for every later use of the library (see
+// utm/tune.h).
+//
+// Usage: utm-convert [-j threads] [-c chunk-bytes] [-z zone] manifest journal
+// 	utm-convert --tune
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utm/runner.h"
+#include "utm/tune.h"
+
+static void usage(char const *argv0)
+{
+	fprintf(stderr,
+		"usage: %s [-j threads] [-c chunk-bytes] [-z zone] "
+		"manifest journal\n"
+		"       %s --tune\n",
+		argv0,
+		argv0);
+	exit(EXIT_FAILURE);
+}
+
+static int tune(char const *argv0)
+{
+	struct utm_tune_config config;
+
+	if (utm_autotune(&config) || utm_tune_save(NULL, &config)) {
+		fprintf(stderr, "%s: cannot tune or save the configuration\n",
+			argv0);
+		return EXIT_FAILURE;
+	}
+
+	fprintf(stderr,
+		"kernel %s, %d threads, grain %zu\n",
+		config.kernel == UTM_KERNEL_TABLES ? "tables" : "series",
+		config.nthreads,
+		config.grain);
+
+	return EXIT_SUCCESS;
+}
+
+int main(int argc, char **argv)
+{
+	struct utm_run_options opts = {0, 0, 0};
+	struct utm_run_stats stats;
+	int i;
+
+	if (argc == 2 && !strcmp(argv[1], "--tune"))
+		return tune(argv[0]);
+
+	for (i = 1; i + 1 < argc && argv[i][0] == '-'; i += 2) {
+		if (!strcmp(argv[i], "-j"))
+			opts.nthreads = atoi(argv[i + 1]);
+		else if (!strcmp(argv[i], "-c"))
+			opts.chunk_size = strtoul(argv[i + 1], NULL, 10);
+		else if (!strcmp(argv[i], "-z"))
+			opts.zone = atoi(argv[i + 1]);
+		else
+			usage(argv[0]);
+	}
+
+	if (argc - i != 2)
+		usage(argv[0]);
+
+	int const failed =
+	    utm_run_manifest(argv[i], argv[i + 1], &opts, &stats);
+	if (failed < 0) {
+		perror(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	fprintf(stderr,
+		"%zu files: %zu converted, %zu already complete, %zu failed\n"
+		"%zu chunks, %zu bytes converted, %zu bytes resumed\n"
+		"%zu points, %zu not convertible\n",
+		stats.files,
+		stats.files - stats.files_skipped - stats.files_failed,
+		stats.files_skipped,
+		stats.files_failed,
+		stats.chunks,
+		stats.bytes,
+		stats.bytes_resumed,
+		stats.points,
+		stats.points_failed);
+
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
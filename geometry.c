@@ -0,0 +1,429 @@
+// This file is part of utm.
+
+// (c) Copyright 2019 Miguel Aguiar.
+//
+// This program is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option) any
+// later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU Lesser General Public License for more details.
+
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utm/geometry.h"
+#include "utm/sched.h"
+#include "utm/utm.h"
+
+// Longitudes are unwrapped along the geometry, so that no edge is longer
+// than 180 degrees, and the zone bands are numbered in the unwrapped
+// longitude: band s spans [-180 + 6s, -174 + 6s) and is zone s mod 60 + 1.
+
+static double wrap180(double d)
+{
+	return d - 360.0 * floor((d + 180.0) / 360.0);
+}
+
+static int band_zone(int band) { return (band % 60 + 60) % 60 + 1; }
+
+static double band_west(int band) { return -180.0 + 6.0 * band; }
+
+// Unwraps the longitudes into u and finds the band of every vertex.
+//
+// Returns:
+// 	Zero, or -1 if a coordinate is NaN.
+static int unwrap(size_t n,
+		  double const *lat,
+		  double const *lon,
+		  double *u,
+		  int *band)
+{
+	int bad = 0;
+
+	for (size_t i = 0; i < n; ++i)
+		bad |= isnan(lat[i]) | isnan(lon[i]);
+	if (bad)
+		return -1;
+
+	u[0] = lon[0];
+	for (size_t i = 1; i < n; ++i)
+		u[i] = wrap180(lon[i] - lon[i - 1]);
+	for (size_t i = 1; i < n; ++i)
+		u[i] += u[i - 1];
+
+	/* Independent per vertex, so this loop vectorizes; the crossings are
+	   then found by comparing the bands of neighbouring vertices. */
+	for (size_t i = 0; i < n; ++i)
+		band[i] = (int)floor((u[i] + 180.0) / 6.0);
+
+	return 0;
+}
+
+// Latitude where the edge ab crosses the unwrapped meridian m.  The
+// endpoints are taken in order of longitude, so that both pieces sharing the
+// crossing get the same value.
+static double crossing_lat(
+    double lat_a, double u_a, double lat_b, double u_b, double m)
+{
+	if (u_a > u_b) {
+		double const t_lat = lat_a, t_u = u_a;
+
+		lat_a = lat_b;
+		u_a = u_b;
+		lat_b = t_lat;
+		u_b = t_u;
+	}
+
+	return lat_a + (m - u_a) / (u_b - u_a) * (lat_b - lat_a);
+}
+
+static int reserve_vertices(struct utm_pieces *out, size_t n)
+{
+	if (n <= out->vertices_cap)
+		return 0;
+
+	size_t const cap =
+	    n > 2 * out->vertices_cap ? n : 2 * out->vertices_cap;
+	double *lat = realloc(out->lat, cap * sizeof *lat);
+	if (lat)
+		out->lat = lat;
+	double *lon = realloc(out->lon, cap * sizeof *lon);
+	if (lon)
+		out->lon = lon;
+	double *x = realloc(out->easting, cap * sizeof *x);
+	if (x)
+		out->easting = x;
+	double *y = realloc(out->northing, cap * sizeof *y);
+	if (y)
+		out->northing = y;
+	size_t *src = realloc(out->source, cap * sizeof *src);
+	if (src)
+		out->source = src;
+
+	if (!lat || !lon || !x || !y || !src)
+		return -1;
+
+	out->vertices_cap = cap;
+	return 0;
+}
+
+// Starts a piece in the given band.  A previous piece left with a single
+// vertex (a geometry starting on a boundary) is dropped.
+static int begin_piece(struct utm_pieces *out, int band)
+{
+	if (out->npieces && out->pieces[out->npieces - 1].count < 2) {
+		out->nvertices -= out->pieces[out->npieces - 1].count;
+		--out->npieces;
+	}
+
+	if (out->npieces == out->pieces_cap) {
+		size_t const cap = out->pieces_cap ? 2 * out->pieces_cap : 8;
+		struct utm_piece *p = realloc(out->pieces, cap * sizeof *p);
+		if (!p)
+			return -1;
+		out->pieces = p;
+		out->pieces_cap = cap;
+	}
+
+	struct utm_piece *p = &out->pieces[out->npieces++];
+
+	p->start = out->nvertices;
+	p->count = 0;
+	p->zone = band; /* Replaced by the zone in finish() */
+
+	return 0;
+}
+
+// Appends a vertex to the current piece, unless it repeats the last one.
+static int push_vertex(struct utm_pieces *out, double lat, double u, size_t src)
+{
+	struct utm_piece *p = &out->pieces[out->npieces - 1];
+	int const band = p->zone;
+
+	/* Longitude within the zone: the same shift of 360 degrees for all
+	   the vertices of the piece. */
+	double const lon = u - 6.0 * (band - (band_zone(band) - 1));
+
+	if (p->count && out->lat[out->nvertices - 1] == lat &&
+	    out->lon[out->nvertices - 1] == lon)
+		return 0;
+
+	if (reserve_vertices(out, out->nvertices + 1))
+		return -1;
+
+	out->lat[out->nvertices] = lat;
+	out->lon[out->nvertices] = lon;
+	out->source[out->nvertices] = src;
+	++out->nvertices;
+	++p->count;
+
+	return 0;
+}
+
+// Projects every piece of a split which gave npieces in its zone, in tasks
+// submitted to exec if it is not null.
+static int finish(struct utm_pieces *out,
+		  int npieces,
+		  struct utm_executor const *exec,
+		  size_t grain)
+{
+	if (npieces <= 0)
+		return npieces;
+
+	for (size_t k = 0; k < out->npieces; ++k) {
+		struct utm_piece *p = &out->pieces[k];
+		double const *lat = out->lat + p->start;
+		double const *lon = out->lon + p->start;
+		double *x = out->easting + p->start;
+		double *y = out->northing + p->start;
+		int failed;
+
+		p->zone = band_zone(p->zone);
+		if (exec)
+			failed = lat_lon_to_utm_batch_parallel(exec,
+							       grain,
+							       p->count,
+							       lat,
+							       lon,
+							       &p->zone,
+							       x,
+							       y,
+							       NULL);
+		else
+			failed = lat_lon_to_utm_batch(
+			    p->count, lat, lon, &p->zone, x, y, NULL);
+
+		if (failed < 0) {
+			out->npieces = out->nvertices = 0;
+			return -1;
+		}
+	}
+
+	return npieces;
+}
+
+// Splits a polyline into pieces, numbered by band instead of zone and not
+// projected yet.
+static int split_polyline(size_t n,
+			  double const *lat,
+			  double const *lon,
+			  struct utm_pieces *out)
+{
+	if ((n && (!lat || !lon)) || !out)
+		return -1;
+
+	out->npieces = out->nvertices = 0;
+	if (n == 0)
+		return 0;
+
+	double *u = malloc(n * sizeof *u);
+	int *band = malloc(n * sizeof *band);
+	int ret = -1;
+
+	if (!u || !band || unwrap(n, lat, lon, u, band))
+		goto out;
+
+	if (begin_piece(out, band[0]) || push_vertex(out, lat[0], u[0], 0))
+		goto out;
+
+	for (size_t i = 1; i < n; ++i) {
+		/* Cut the edge at every boundary between the two bands. */
+		for (int b = band[i - 1]; b != band[i];) {
+			int const step = band[i] > b ? 1 : -1;
+			double const m = band_west(step > 0 ? b + 1 : b);
+			double const clat =
+			    crossing_lat(lat[i - 1], u[i - 1], lat[i], u[i], m);
+
+			b += step;
+			if (push_vertex(out, clat, m, UTM_SEAM_VERTEX) ||
+			    begin_piece(out, b) ||
+			    push_vertex(out, clat, m, UTM_SEAM_VERTEX))
+				goto out;
+		}
+
+		if (push_vertex(out, lat[i], u[i], i))
+			goto out;
+	}
+
+	if (out->npieces > 1 && out->pieces[out->npieces - 1].count < 2) {
+		out->nvertices -= out->pieces[out->npieces - 1].count;
+		--out->npieces;
+	}
+
+	ret = (int)out->npieces;
+
+out:
+	free(u);
+	free(band);
+
+	if (ret < 0)
+		out->npieces = out->nvertices = 0;
+
+	return ret;
+}
+
+// Splits a polygon ring as split_polyline.
+static int split_polygon(size_t n,
+			 double const *lat,
+			 double const *lon,
+			 struct utm_pieces *out)
+{
+	if (!lat || !lon || !out)
+		return -1;
+
+	out->npieces = out->nvertices = 0;
+
+	if (n > 1 && lat[n - 1] == lat[0] && lon[n - 1] == lon[0])
+		--n;
+	if (n < 3)
+		return -1;
+
+	double *u = malloc(n * sizeof *u);
+	int *band = malloc(n * sizeof *band);
+	double *ring = NULL;
+	size_t *src = NULL;
+	int ret = -1;
+
+	if (!u || !band || unwrap(n, lat, lon, u, band))
+		goto out;
+
+	/* A ring around a pole does not come back to its first longitude. */
+	if (fabs(u[n - 1] + wrap180(lon[0] - lon[n - 1]) - u[0]) > 180.0)
+		goto out;
+
+	/* Insert the boundary crossings into the ring, each computed once
+	   from its edge.  Clipping the ring to a band then only selects the
+	   vertices within it, which gives the same pieces as
+	   Sutherland-Hodgman and the same seam vertices on both sides. */
+	size_t len = n;
+	int lo = band[0], hi = band[0];
+
+	for (size_t i = 0; i < n; ++i) {
+		int const next = band[(i + 1) % n];
+
+		len += (size_t)abs(next - band[i]);
+		lo = band[i] < lo ? band[i] : lo;
+		hi = band[i] > hi ? band[i] : hi;
+	}
+
+	ring = malloc(2 * len * sizeof *ring);
+	src = malloc(len * sizeof *src);
+	if (!ring || !src)
+		goto out;
+
+	double *rlat = ring, *ru = ring + len;
+	size_t k = 0;
+
+	for (size_t i = 0; i < n; ++i) {
+		size_t const j = (i + 1) % n;
+
+		rlat[k] = lat[i];
+		ru[k] = u[i];
+		src[k++] = i;
+
+		for (int b = band[i]; b != band[j];) {
+			int const step = band[j] > b ? 1 : -1;
+			double const m = band_west(step > 0 ? b + 1 : b);
+
+			rlat[k] = crossing_lat(lat[i], u[i], lat[j], u[j], m);
+			ru[k] = m;
+			src[k++] = UTM_SEAM_VERTEX;
+			b += step;
+		}
+	}
+
+	for (int b = lo; b <= hi; ++b) {
+		double const west = band_west(b), east = band_west(b + 1);
+
+		if (begin_piece(out, b))
+			goto out;
+
+		for (size_t i = 0; i < len; ++i)
+			if (ru[i] >= west && ru[i] <= east &&
+			    push_vertex(out, rlat[i], ru[i], src[i]))
+				goto out;
+
+		/* Drop a piece reduced to a boundary segment. */
+		if (out->pieces[out->npieces - 1].count < 3) {
+			out->nvertices -= out->pieces[out->npieces - 1].count;
+			--out->npieces;
+		}
+	}
+
+	ret = (int)out->npieces;
+
+out:
+	free(u);
+	free(band);
+	free(ring);
+	free(src);
+
+	if (ret < 0)
+		out->npieces = out->nvertices = 0;
+
+	return ret;
+}
+
+int utm_split_polyline(size_t n,
+		       double const *lat,
+		       double const *lon,
+		       struct utm_pieces *out)
+{
+	return finish(out, split_polyline(n, lat, lon, out), NULL, 0);
+}
+
+int utm_split_polygon(size_t n,
+		      double const *lat,
+		      double const *lon,
+		      struct utm_pieces *out)
+{
+	return finish(out, split_polygon(n, lat, lon, out), NULL, 0);
+}
+
+int utm_split_polyline_parallel(struct utm_executor const *exec,
+				size_t grain,
+				size_t n,
+				double const *lat,
+				double const *lon,
+				struct utm_pieces *out)
+{
+	if (!exec || !exec->submit || !exec->wait)
+		return -1;
+
+	return finish(out, split_polyline(n, lat, lon, out), exec, grain);
+}
+
+int utm_split_polygon_parallel(struct utm_executor const *exec,
+			       size_t grain,
+			       size_t n,
+			       double const *lat,
+			       double const *lon,
+			       struct utm_pieces *out)
+{
+	if (!exec || !exec->submit || !exec->wait)
+		return -1;
+
+	return finish(out, split_polygon(n, lat, lon, out), exec, grain);
+}
+
+void utm_pieces_free(struct utm_pieces *out)
+{
+	if (!out)
+		return;
+
+	free(out->pieces);
+	free(out->lat);
+	free(out->lon);
+	free(out->easting);
+	free(out->northing);
+	free(out->source);
+	memset(out, 0, sizeof *out);
+}
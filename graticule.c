@@ -0,0 +1,484 @@
+// This file is part of utm.
+
+// (c) Copyright 2019 Miguel Aguiar.
+//
+// This program is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option) any
+// later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU Lesser General Public License for more details.
+
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utm/graticule.h"
+#include "utm/utm.h"
+
+// Limits of UTM, which are also the limits of the MGRS latitude bands
+#define UTM_SOUTH -80.0
+#define UTM_NORTH 84.0
+
+// Segments a grid line is cut into before the adaptive sampling, so that a
+// bend between two samples is not missed
+#define GRID_SEGMENTS 8
+
+// Shortest segment split by the adaptive sampling, in meters
+#define GRID_MIN_STEP 1.0
+
+// Initial capacity of the subdivision stack, which grows as needed: the
+// initial segments plus one per halving of a 20000 km segment down to
+// GRID_MIN_STEP fit
+#define GRID_STACK 64
+
+// Most grid lines of each kind drawn in a part of a zone, beyond which the
+// interval is too small for the viewport
+#define GRID_MAX_LINES (1L << 20)
+
+// Region of the viewport within the band of one zone and, for the grid
+// lines, one hemisphere.  Longitudes are unwrapped along the viewport.
+struct part {
+	int zone;
+	int southhemi;
+	double south, north;
+	double west, east;
+	double cm;    /* Central meridian */
+	double shift; /* From unwrapped to output longitudes */
+};
+
+struct sample {
+	double t; /* Northing or easting along the line */
+	double lat, lon;
+};
+
+// Draws lines clipped to a part into the output.
+struct pen {
+	struct utm_graticule *out;
+	struct part const *part;
+	struct utm_grid_line line; /* Kind and value of the lines drawn */
+	int drawing;		   /* Whether the last line is open */
+	int failed;
+	struct sample (*stack)[2]; /* Subdivision stack of trace */
+	size_t stack_cap;
+};
+
+static int reserve_vertices(struct utm_graticule *out, size_t n)
+{
+	if (n <= out->vertices_cap)
+		return 0;
+
+	size_t const cap =
+	    n > 2 * out->vertices_cap ? n : 2 * out->vertices_cap;
+	double *lat = realloc(out->lat, cap * sizeof *lat);
+	if (lat)
+		out->lat = lat;
+	double *lon = realloc(out->lon, cap * sizeof *lon);
+	if (lon)
+		out->lon = lon;
+
+	if (!lat || !lon)
+		return -1;
+
+	out->vertices_cap = cap;
+	return 0;
+}
+
+// Starts a line.  A previous line left with a single vertex is dropped.
+static int begin_line(struct utm_graticule *out,
+		      struct utm_grid_line const *line)
+{
+	if (out->nlines && out->lines[out->nlines - 1].count < 2) {
+		out->nvertices -= out->lines[out->nlines - 1].count;
+		--out->nlines;
+	}
+
+	if (out->nlines == out->lines_cap) {
+		size_t const cap = out->lines_cap ? 2 * out->lines_cap : 64;
+		struct utm_grid_line *l = realloc(out->lines, cap * sizeof *l);
+		if (!l)
+			return -1;
+		out->lines = l;
+		out->lines_cap = cap;
+	}
+
+	struct utm_grid_line *l = &out->lines[out->nlines++];
+
+	*l = *line;
+	l->start = out->nvertices;
+	l->count = 0;
+
+	return 0;
+}
+
+static int push_vertex(struct utm_graticule *out, double lat, double lon)
+{
+	if (reserve_vertices(out, out->nvertices + 1))
+		return -1;
+
+	out->lat[out->nvertices] = lat;
+	out->lon[out->nvertices] = lon;
+	++out->nvertices;
+	++out->lines[out->nlines - 1].count;
+
+	return 0;
+}
+
+// Clips the segment ab to the part (Liang-Barsky), in place.
+//
+// Returns:
+// 	Zero if nothing is left, otherwise 1, plus 2 if a was moved and 4 if b
+// 	was moved.
+static int clip(struct part const *p, double *alat, double *alon,
+		double *blat, double *blon)
+{
+	double const dlon = *blon - *alon, dlat = *blat - *alat;
+	double const d[4] = {-dlon, dlon, -dlat, dlat};
+	double const q[4] = {*alon - p->west, p->east - *alon,
+			     *alat - p->south, p->north - *alat};
+	double t0 = 0.0, t1 = 1.0;
+
+	for (int k = 0; k < 4; ++k) {
+		if (d[k] == 0.0) {
+			if (q[k] < 0.0)
+				return 0;
+			continue;
+		}
+
+		double const r = q[k] / d[k];
+
+		if (d[k] < 0.0 && r > t0)
+			t0 = r;
+		else if (d[k] > 0.0 && r < t1)
+			t1 = r;
+	}
+
+	if (t0 > t1)
+		return 0;
+
+	double const lat0 = *alat, lon0 = *alon;
+
+	*alat = lat0 + t0 * dlat;
+	*alon = lon0 + t0 * dlon;
+	*blat = lat0 + t1 * dlat;
+	*blon = lon0 + t1 * dlon;
+
+	return 1 | (t0 > 0.0 ? 2 : 0) | (t1 < 1.0 ? 4 : 0);
+}
+
+static void draw(struct pen *pen,
+		 struct sample const *a,
+		 struct sample const *b)
+{
+	double alat = a->lat, alon = a->lon, blat = b->lat, blon = b->lon;
+	int const c = clip(pen->part, &alat, &alon, &blat, &blon);
+	double const shift = pen->part->shift;
+
+	if (!c || pen->failed) {
+		pen->drawing = 0;
+		return;
+	}
+
+	if (!pen->drawing || (c & 2)) {
+		if (begin_line(pen->out, &pen->line) ||
+		    push_vertex(pen->out, alat, alon + shift)) {
+			pen->failed = 1;
+			return;
+		}
+	}
+
+	if (push_vertex(pen->out, blat, blon + shift))
+		pen->failed = 1;
+
+	pen->drawing = !(c & 4);
+}
+
+// Projects a point of the part.  Northings of the south part are given
+// with the false northing, including on the equator.
+static void project(struct part const *p, double lat, double lon,
+		    double *x, double *y)
+{
+	lat_lon_to_utm(lat, lon + p->shift, &p->zone, x, y);
+	if (p->southhemi && *y < 5000000.0)
+		*y += 10000000.0;
+}
+
+static void sample_at(struct part const *p, int easting_line, double value,
+		      double t, struct sample *s)
+{
+	s->t = t;
+	if (easting_line)
+		utm_to_lat_lon(
+		    value, t, p->zone, p->southhemi, &s->lat, &s->lon);
+	else
+		utm_to_lat_lon(
+		    t, value, p->zone, p->southhemi, &s->lat, &s->lon);
+
+	s->lon += 360.0 * round((p->cm - s->lon) / 360.0);
+}
+
+static int reserve_stack(struct pen *pen, size_t n)
+{
+	if (n <= pen->stack_cap)
+		return 0;
+
+	size_t const cap = pen->stack_cap ? 2 * pen->stack_cap : GRID_STACK;
+	struct sample(*st)[2] = realloc(pen->stack, cap * sizeof *st);
+	if (!st) {
+		pen->failed = 1;
+		return -1;
+	}
+
+	pen->stack = st;
+	pen->stack_cap = cap;
+	return 0;
+}
+
+// Draws the grid line of the given easting or northing, from t0 to t1 along
+// it, splitting its chords until they are within tol of the line.
+static void trace(struct pen *pen, int easting_line, double value,
+		  double t0, double t1, double tol)
+{
+	struct part const *p = pen->part;
+	struct sample s[GRID_SEGMENTS + 1];
+	size_t top = 0;
+
+	pen->line.kind = easting_line ? UTM_GRID_EASTING : UTM_GRID_NORTHING;
+	pen->line.value = value;
+	pen->drawing = 0;
+
+	for (int k = 0; k <= GRID_SEGMENTS; ++k)
+		sample_at(p, easting_line, value,
+			  t0 + (t1 - t0) * k / GRID_SEGMENTS, &s[k]);
+
+	for (int k = GRID_SEGMENTS; k > 0; --k) {
+		if (reserve_stack(pen, top + 1))
+			return;
+		pen->stack[top][0] = s[k - 1];
+		pen->stack[top][1] = s[k];
+		++top;
+	}
+
+	while (top) {
+		--top;
+		struct sample const a = pen->stack[top][0];
+		struct sample const b = pen->stack[top][1];
+
+		if (b.t - a.t > GRID_MIN_STEP) {
+			struct sample m;
+
+			sample_at(
+			    p, easting_line, value, 0.5 * (a.t + b.t), &m);
+			if (fabs(m.lat - 0.5 * (a.lat + b.lat)) > tol ||
+			    fabs(m.lon - 0.5 * (a.lon + b.lon)) > tol) {
+				if (reserve_stack(pen, top + 2))
+					return;
+				pen->stack[top][0] = m;
+				pen->stack[top][1] = b;
+				++top;
+				pen->stack[top][0] = a;
+				pen->stack[top][1] = m;
+				++top;
+				continue;
+			}
+		}
+
+		draw(pen, &a, &b);
+	}
+
+	pen->drawing = 0;
+}
+
+// Extends the bounding box {xmin, xmax, ymin, ymax} to a point of the part.
+static void extend(struct part const *p, double lat, double lon, double *box)
+{
+	double x, y;
+
+	project(p, lat, lon, &x, &y);
+	box[0] = x < box[0] ? x : box[0];
+	box[1] = x > box[1] ? x : box[1];
+	box[2] = y < box[2] ? y : box[2];
+	box[3] = y > box[3] ? y : box[3];
+}
+
+// Draws the grid lines of a part of one zone and hemisphere.
+static int grid(struct utm_graticule *out, struct part const *p,
+		double interval, double tol)
+{
+	double box[4] = {HUGE_VAL, -HUGE_VAL, HUGE_VAL, -HUGE_VAL};
+
+	/* Bounding box of the part in the grid, from its edges and the
+	   central meridian, where the parallels reach their lowest northing
+	   in the north and highest in the south. */
+	for (int k = 0; k <= 2 * GRID_SEGMENTS; ++k) {
+		double const f = (double)k / (2 * GRID_SEGMENTS);
+		double const lat = p->south + f * (p->north - p->south);
+		double const lon = p->west + f * (p->east - p->west);
+
+		extend(p, lat, p->west, box);
+		extend(p, lat, p->east, box);
+		extend(p, p->south, lon, box);
+		extend(p, p->north, lon, box);
+	}
+
+	if (p->cm > p->west && p->cm < p->east) {
+		extend(p, p->south, p->cm, box);
+		extend(p, p->north, p->cm, box);
+	}
+
+	double const mx = 0.01 * (box[1] - box[0]) + 1.0;
+	double const my = 0.01 * (box[3] - box[2]) + 1.0;
+	double const xmin = box[0] - mx, xmax = box[1] + mx;
+	double const ymin = box[2] - my, ymax = box[3] + my;
+
+	/* Count the lines first: past 2^53 / interval, k * interval would not
+	   even advance. */
+	double const kx = ceil(xmin / interval), ky = ceil(ymin / interval);
+	double const nx = floor(xmax / interval) - kx + 1.0;
+	double const ny = floor(ymax / interval) - ky + 1.0;
+
+	if (!(nx <= GRID_MAX_LINES && ny <= GRID_MAX_LINES))
+		return -1;
+
+	struct pen pen = {out, p, {0}, 0, 0, NULL, 0};
+
+	pen.line.zone = p->zone;
+	pen.line.southhemi = p->southhemi;
+
+	for (long k = 0; k < (long)nx && !pen.failed; ++k)
+		trace(&pen, 1, (kx + k) * interval, ymin, ymax, tol);
+
+	for (long k = 0; k < (long)ny && !pen.failed; ++k) {
+		/* The equator is drawn from the north. */
+		if (p->southhemi && (ky + k) * interval >= 10000000.0)
+			break;
+		trace(&pen, 0, (ky + k) * interval, xmin, xmax, tol);
+	}
+
+	free(pen.stack);
+
+	return pen.failed ? -1 : 0;
+}
+
+// Draws a line straight in latitude/longitude.
+static int segment(struct utm_graticule *out,
+		   struct utm_grid_line const *line,
+		   double lat0, double lon0, double lat1, double lon1)
+{
+	return begin_line(out, line) || push_vertex(out, lat0, lon0) ||
+	       push_vertex(out, lat1, lon1);
+}
+
+int utm_graticule(double south,
+		  double west,
+		  double north,
+		  double east,
+		  double interval,
+		  double tolerance,
+		  struct utm_graticule *out)
+{
+	if (!out)
+		return -1;
+
+	out->nlines = out->nvertices = 0;
+
+	if (!(south >= -90.0 && north <= 90.0 && south <= north) ||
+	    !isfinite(west) || !isfinite(east) || !(interval > 0.0) ||
+	    !(tolerance > 0.0))
+		return -1;
+
+	/* Unwrap the viewport eastwards from west. */
+	if (east < west)
+		east += 360.0;
+	if (east - west > 360.0)
+		east = west + 360.0;
+
+	double const s = south > UTM_SOUTH ? south : UTM_SOUTH;
+	double const n = north < UTM_NORTH ? north : UTM_NORTH;
+
+	if (s >= n)
+		return 0;
+
+	int const first = (int)floor((west + 180.0) / 6.0);
+	int const last = (int)ceil((east + 180.0) / 6.0);
+
+	for (int b = first; b < last; ++b) {
+		double const bw = -180.0 + 6.0 * b;
+		struct part p;
+
+		p.zone = (b % 60 + 60) % 60 + 1;
+		p.shift = 6.0 * (p.zone - 1 - b);
+		p.cm = bw + 3.0;
+		p.west = west > bw ? west : bw;
+		p.east = east < bw + 6.0 ? east : bw + 6.0;
+
+		if (p.west >= p.east)
+			continue;
+
+		struct utm_grid_line line = {0};
+
+		line.zone = p.zone;
+
+		/* Zone boundary on the west of the band */
+		if (bw >= west) {
+			line.kind = UTM_GRID_ZONE;
+			line.value = bw + p.shift;
+			if (segment(out, &line, s, line.value, n, line.value))
+				goto fail;
+		}
+
+		/* Latitude band boundaries, every 8 degrees but for the
+		   12 degrees of band X. */
+		line.kind = UTM_GRID_BAND;
+		for (double lat = UTM_SOUTH; lat <= UTM_NORTH;
+		     lat += lat < 72.0 ? 8.0 : 12.0) {
+			if (lat < s || lat > n)
+				continue;
+
+			line.southhemi = lat < 0.0;
+			line.value = lat;
+			if (segment(out, &line, lat, p.west + p.shift, lat,
+				    p.east + p.shift))
+				goto fail;
+		}
+
+		for (int south_part = 1; south_part >= 0; --south_part) {
+			p.southhemi = south_part;
+			p.south = south_part ? s : (s > 0.0 ? s : 0.0);
+			p.north = south_part ? (n < 0.0 ? n : 0.0) : n;
+
+			if (p.south < p.north &&
+			    grid(out, &p, interval, tolerance))
+				goto fail;
+		}
+	}
+
+	/* Drop a last line left with a single vertex. */
+	if (out->nlines && out->lines[out->nlines - 1].count < 2) {
+		out->nvertices -= out->lines[out->nlines - 1].count;
+		--out->nlines;
+	}
+
+	return (int)out->nlines;
+
+fail:
+	out->nlines = out->nvertices = 0;
+	return -1;
+}
+
+void utm_graticule_free(struct utm_graticule *out)
+{
+	if (!out)
+		return;
+
+	free(out->lines);
+	free(out->lat);
+	free(out->lon);
+	memset(out, 0, sizeof *out);
+}
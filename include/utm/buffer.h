@@ -0,0 +1,99 @@
+// This file is part of utm.
+
+// (c) Copyright 2019 Miguel Aguiar.
+//
+// This program is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option) any
+// later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU Lesser General Public License for more details.
+
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef UTM_BUFFER_HEADER_GUARD_
+#define UTM_BUFFER_HEADER_GUARD_
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Alignment of the columns of a point buffer, in bytes: a cache line and the
+// widest vector register.
+#define UTM_BUFFER_ALIGN 64
+
+// The capacity of a point buffer is a multiple of this number of points, so
+// that every column, including the zones, ends on an aligned boundary.
+#define UTM_BUFFER_PAD 16
+
+// Flags of utm_point_buffer_init.
+enum {
+	UTM_BUFFER_HUGE_PAGES = 1, /* Ask for huge pages, if available */
+};
+
+// Points stored as one aligned column per coordinate.  The columns are
+// allocated in one block and padded to the capacity; the padding holds valid
+// points (zero when allocated), so the conversion routines below can process
+// whole vectors without a remainder loop.  The fields may be read and the
+// columns written freely; n may be lowered, but not above the capacity.
+struct utm_point_buffer {
+	size_t n;	 /* Number of points */
+	size_t capacity; /* Allocated points, a multiple of UTM_BUFFER_PAD */
+	double *lat;
+	double *lon;
+	double *easting;
+	double *northing;
+	int *zone;
+
+	/* Private */
+	void *block;
+	size_t bytes;
+	int mapped;
+};
+
+// Allocates a buffer of n points, with all columns zeroed.
+//
+// Inputs:
+// 	n	Number of points.
+// 	flags	UTM_BUFFER_HUGE_PAGES or zero.  Huge pages are a hint: the
+// 		buffer is still allocated if the system does not provide them.
+//
+// Returns:
+// 	Zero, or -1 if buf is null or the memory cannot be allocated, in
+// 	which case *buf is zeroed.
+int utm_point_buffer_init(struct utm_point_buffer *buf, size_t n, int flags);
+
+// Frees the columns of a buffer and zeroes it.  A zeroed buffer may be freed
+// again.
+void utm_point_buffer_free(struct utm_point_buffer *buf);
+
+// Converts the latitudes and longitudes of a buffer to eastings, northings
+// and zones, as lat_lon_to_utm_batch does, but without the alignment and
+// remainder handling of arbitrary arrays: the padding after the last point
+// is converted as well.
+//
+// Returns:
+// 	The number of points among the first n which could not be converted,
+// 	or -1 if buf is null or *zone is invalid.
+int utm_point_buffer_forward(struct utm_point_buffer *buf, int const *zone);
+
+// Converts the eastings and northings of a buffer to latitudes and
+// longitudes, as utm_to_lat_lon_batch does.  The zone column is not used.
+//
+// Returns:
+// 	Zero, or -1 if buf is null.
+int utm_point_buffer_inverse(struct utm_point_buffer *buf,
+			     int zone,
+			     int southhemi);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
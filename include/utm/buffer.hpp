@@ -0,0 +1,93 @@
+// This file is part of utm.
+
+// (c) Copyright 2019 Miguel Aguiar.
+//
+// This program is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option) any
+// later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU Lesser General Public License for more details.
+
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef UTM_BUFFER_HPP_HEADER_GUARD_
+#define UTM_BUFFER_HPP_HEADER_GUARD_
+
+#include <cstddef>
+#include <new>
+
+#include "utm/buffer.h"
+
+namespace utm {
+
+// Owning wrapper of struct utm_point_buffer (C++11).  Throws std::bad_alloc
+// if the buffer cannot be allocated; movable, not copyable.
+class point_buffer {
+public:
+	explicit point_buffer(std::size_t n, int flags = 0)
+	{
+		if (utm_point_buffer_init(&buf_, n, flags))
+			throw std::bad_alloc();
+	}
+
+	~point_buffer() { utm_point_buffer_free(&buf_); }
+
+	point_buffer(point_buffer const &) = delete;
+	point_buffer &operator=(point_buffer const &) = delete;
+
+	point_buffer(point_buffer &&other) noexcept : buf_(other.buf_)
+	{
+		other.buf_ = utm_point_buffer();
+	}
+
+	point_buffer &operator=(point_buffer &&other) noexcept
+	{
+		if (this != &other) {
+			utm_point_buffer_free(&buf_);
+			buf_ = other.buf_;
+			other.buf_ = utm_point_buffer();
+		}
+		return *this;
+	}
+
+	std::size_t size() const { return buf_.n; }
+	std::size_t capacity() const { return buf_.capacity; }
+
+	double *lat() { return buf_.lat; }
+	double *lon() { return buf_.lon; }
+	double *easting() { return buf_.easting; }
+	double *northing() { return buf_.northing; }
+	int *zone() { return buf_.zone; }
+
+	double const *lat() const { return buf_.lat; }
+	double const *lon() const { return buf_.lon; }
+	double const *easting() const { return buf_.easting; }
+	double const *northing() const { return buf_.northing; }
+	int const *zone() const { return buf_.zone; }
+
+	// See utm_point_buffer_forward and utm_point_buffer_inverse.
+	int forward(int const *zone = nullptr)
+	{
+		return utm_point_buffer_forward(&buf_, zone);
+	}
+
+	int inverse(int zone, bool southhemi)
+	{
+		return utm_point_buffer_inverse(&buf_, zone, southhemi ? 1 : 0);
+	}
+
+	utm_point_buffer *get() { return &buf_; }
+	utm_point_buffer const *get() const { return &buf_; }
+
+private:
+	utm_point_buffer buf_ = utm_point_buffer();
+};
+
+} // namespace utm
+
+#endif
@@ -0,0 +1,129 @@
+// This file is part of utm.
+
+// (c) Copyright 2019 Miguel Aguiar.
+//
+// This program is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option) any
+// later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU Lesser General Public License for more details.
+
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef UTM_GEOMETRY_HEADER_GUARD_
+#define UTM_GEOMETRY_HEADER_GUARD_
+
+#include <stddef.h>
+
+#include "utm/sched.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Splitting of geometries at zone boundaries.
+//
+// A polyline or polygon ring crossing the meridian between two zones is cut
+// into one piece per zone, each projected in its own zone with
+// lat_lon_to_utm_batch, instead of being distorted by a single zone or torn
+// apart by a zone per vertex.  Edges are taken as straight lines in
+// latitude/longitude and follow the shorter way around the globe, so
+// geometries may cross the antimeridian.  The vertices where an edge crosses a
+// boundary are added to the pieces on both sides, with identical
+// coordinates.
+
+// Source index of the vertices added at zone boundaries
+#define UTM_SEAM_VERTEX ((size_t)-1)
+
+struct utm_piece {
+	size_t start; /* First vertex of the piece */
+	size_t count; /* Number of vertices */
+	int zone;
+};
+
+// Pieces of a split geometry.  The vertices of all pieces are stored one
+// after the other; longitudes are given within 3 degrees of the central
+// meridian of the zone of their piece, so boundary vertices on the
+// antimeridian are at 180 in zone 60 and -180 in zone 1.
+struct utm_pieces {
+	size_t npieces;
+	struct utm_piece *pieces;
+
+	size_t nvertices;
+	double *lat;
+	double *lon;
+	double *easting;
+	double *northing;
+	size_t *source; /* Input index, or UTM_SEAM_VERTEX */
+
+	/* Private */
+	size_t pieces_cap;
+	size_t vertices_cap;
+};
+
+// Splits a polyline at the zone boundaries it crosses.  Consecutive pieces
+// share their end and start vertex.
+//
+// Inputs:
+// 	n	Number of vertices.
+// 	lat	Latitudes of the vertices, in degrees.
+// 	lon	Longitudes of the vertices, in degrees.
+//
+// Outputs:
+// 	out	The pieces, which must be zeroed before the first use and
+// 		freed with utm_pieces_free.  It is overwritten by each call.
+//
+// Returns:
+// 	The number of pieces, or -1 if any of the arrays is null, a
+// 	coordinate is NaN or memory cannot be allocated.
+int utm_split_polyline(size_t n,
+		       double const *lat,
+		       double const *lon,
+		       struct utm_pieces *out);
+
+// Splits a polygon ring at the zone boundaries it crosses.  Each piece is the
+// ring clipped to the longitude band of its zone (Sutherland-Hodgman), as an
+// open ring.  A concave ring leaving a band and coming back gives a single
+// piece with zero-width edges along the boundary.  Holes are split as
+// separate rings.  The ring may be closed (last vertex equal to the first) or
+// not.
+//
+// Returns:
+// 	The number of pieces, or -1 if any of the arrays is null, a
+// 	coordinate is NaN, the ring has fewer than 3 vertices or encloses a
+// 	pole, or memory cannot be allocated.
+int utm_split_polygon(size_t n,
+		      double const *lat,
+		      double const *lon,
+		      struct utm_pieces *out);
+
+// Same as utm_split_polyline and utm_split_polygon, but the pieces are
+// projected with lat_lon_to_utm_batch_parallel, in tasks of grain vertices
+// (0 picks a default) submitted to exec, such as that of utm_sched_executor.
+// -1 is also returned if exec is null or incomplete.
+int utm_split_polyline_parallel(struct utm_executor const *exec,
+				size_t grain,
+				size_t n,
+				double const *lat,
+				double const *lon,
+				struct utm_pieces *out);
+int utm_split_polygon_parallel(struct utm_executor const *exec,
+			       size_t grain,
+			       size_t n,
+			       double const *lat,
+			       double const *lon,
+			       struct utm_pieces *out);
+
+// Frees the arrays of out and zeroes it.
+void utm_pieces_free(struct utm_pieces *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
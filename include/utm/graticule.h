@@ -0,0 +1,115 @@
+// This file is part of utm.
+
+// (c) Copyright 2019 Miguel Aguiar.
+//
+// This program is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option) any
+// later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU Lesser General Public License for more details.
+
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef UTM_GRATICULE_HEADER_GUARD_
+#define UTM_GRATICULE_HEADER_GUARD_
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// UTM grid overlays for maps in latitude/longitude.
+//
+// utm_graticule gives the lines of a UTM grid over a viewport as
+// latitude/longitude polylines, ready to be drawn over a geographic basemap:
+// the lines of constant easting and northing at a given interval within each
+// zone, the zone boundaries, and the parallels bounding the MGRS latitude
+// bands.  With an interval of 100 km the grid lines are the edges of the MGRS
+// 100 km squares (the special zones of Norway and Svalbard are not handled).
+//
+// Grid lines are curves in latitude/longitude.  They are sampled adaptively:
+// a segment is split until the midpoint of its chord is within the tolerance
+// of the line, so straight stretches take few points and the count grows
+// only where the lines bend.  The lines are clipped to the viewport and to
+// the band and hemisphere of their zone.
+
+enum utm_grid_kind {
+	UTM_GRID_EASTING = 0,  /* Line of constant easting */
+	UTM_GRID_NORTHING = 1, /* Line of constant northing */
+	UTM_GRID_ZONE = 2,     /* Meridian between two zones */
+	UTM_GRID_BAND = 3,     /* Parallel between two MGRS latitude bands */
+};
+
+struct utm_grid_line {
+	size_t start; /* First vertex of the line */
+	size_t count; /* Number of vertices */
+	int kind;     /* enum utm_grid_kind */
+	int zone;     /* Zone of the line, or east of a zone boundary */
+	int southhemi;
+	double value; /* Easting or northing in meters, longitude or latitude */
+};
+
+// Lines of a graticule.  The vertices of all lines are stored one after the
+// other; longitudes are given within 3 degrees of the central meridian of the
+// zone of their line, so lines never cross the antimeridian.
+struct utm_graticule {
+	size_t nlines;
+	struct utm_grid_line *lines;
+
+	size_t nvertices;
+	double *lat;
+	double *lon;
+
+	/* Private */
+	size_t lines_cap;
+	size_t vertices_cap;
+};
+
+// Computes the graticule of a viewport.  The arrays of out are reused from
+// one call to the next and only grow when a viewport needs more room, so
+// redrawing a map allocates nothing once they are large enough.
+//
+// Inputs:
+// 	south	Southern edge of the viewport, in degrees.
+// 	west	Western edge, in degrees.
+// 	north	Northern edge, in degrees.
+// 	east	Eastern edge, in degrees.  The viewport crosses the
+// 		antimeridian if it is less than west.
+// 	interval	Spacing of the grid lines, in meters.
+// 	tolerance	Largest distance between the polylines and the grid
+// 			lines, in degrees; the size of a pixel, for maps.
+//
+// Outputs:
+// 	out	The lines, which must be zeroed before the first use and
+// 		freed with utm_graticule_free.  It is overwritten by each call.
+//
+// The parts of the viewport beyond the UTM limits (south of 80S and north of
+// 84N) have no grid.
+//
+// Returns:
+// 	The number of lines, or -1 if out is null, the viewport or the
+// 	interval is invalid, the interval is so small that a zone of the
+// 	viewport would have over a million lines of easting or northing, the
+// 	tolerance is not positive or memory cannot be allocated.
+int utm_graticule(double south,
+		  double west,
+		  double north,
+		  double east,
+		  double interval,
+		  double tolerance,
+		  struct utm_graticule *out);
+
+// Frees the arrays of out and zeroes it.
+void utm_graticule_free(struct utm_graticule *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,141 @@
+// This file is part of utm.
+
+// (c) Copyright 2019 Miguel Aguiar.
+//
+// This program is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option) any
+// later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU Lesser General Public License for more details.
+
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef UTM_PIPELINE_HEADER_GUARD_
+#define UTM_PIPELINE_HEADER_GUARD_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "utm/sched.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Fused processing of points through a chain of stages.
+//
+// A pipeline is a list of stages, each run over a block of points stored as
+// columns.  The library stages project the points, quantize the coordinates
+// to a grid, interleave them into a spatial key and count the keys in bins;
+// callbacks may be added anywhere in the chain to read or modify the columns.
+// utm_pipeline_run takes the points block by block, with blocks sized to fit
+// the columns in the L2 cache, and runs every stage on a block before
+// moving to the next one.  The intermediate columns are then never written
+// back to memory, where running each stage over the whole array would stream
+// all of them through it once per stage.
+
+// Quantized coordinate of a point which could not be projected or is outside
+// the grid
+#define UTM_QUANT_NONE UINT32_MAX
+
+// Key of a point with a coordinate UTM_QUANT_NONE
+#define UTM_KEY_NONE UINT64_MAX
+
+// Columns of a block.  The inputs are the slice of the arrays passed to
+// utm_pipeline_run starting at offset; the other columns are scratch space of
+// the block, filled by the stages which write them.
+struct utm_block {
+	size_t offset; /* Index of the first point of the block */
+	size_t n;      /* Number of points of the block */
+	double const *lat;
+	double const *lon;
+	double *easting;  /* Written by projection */
+	double *northing; /* Written by projection */
+	int *zones;	  /* Written by projection, -1 for failed points */
+	uint32_t *qx;	  /* Written by quantization */
+	uint32_t *qy;	  /* Written by quantization */
+	uint64_t *key;	  /* Written by the spatial key */
+};
+
+// Callback stage.  It may be called concurrently from several threads on
+// different blocks.
+typedef void (*utm_stage_fn)(void *arg, struct utm_block *block);
+
+struct utm_pipeline;
+
+// Returns an empty pipeline, or null if it could not be allocated.
+struct utm_pipeline *utm_pipeline_create(void);
+
+// Frees the pipeline.
+void utm_pipeline_destroy(struct utm_pipeline *pipeline);
+
+// The functions below append a stage to the pipeline.  Stages which read the
+// columns written by another stage must be added after it.
+//
+// Returns:
+// 	Zero, or -1 if the arguments are invalid, the columns read by the
+// 	stage are not written by an earlier one or memory is exhausted.
+
+// Projects the points as lat_lon_to_utm_batch does, in the zone *zone, or
+// the zone of each point if zone is null.
+int utm_pipeline_project(struct utm_pipeline *pipeline, int const *zone);
+
+// Quantizes the coordinates into cells of size meters from the corner
+// (easting0, northing0): qx = floor((easting - easting0) / size).
+// Coordinates below the corner or more than 2^32 - 2 cells above it give
+// UTM_QUANT_NONE.
+int utm_pipeline_quantize(struct utm_pipeline *pipeline,
+			  double easting0,
+			  double northing0,
+			  double size);
+
+// Interleaves the bits of qx and qy into a Morton key, qx taking the even
+// bits, so that cells close in the grid mostly get close keys.
+int utm_pipeline_key(struct utm_pipeline *pipeline);
+
+// Counts the points in 2^bits bins by the top bits of their key, adding to
+// counts, which must hold 2^bits counters.  Points without a key are not
+// counted.
+//
+// Inputs:
+// 	bits	Number of bits of the bins, between 1 and 32.
+int utm_pipeline_bin(struct utm_pipeline *pipeline,
+		     unsigned bits,
+		     unsigned long long *counts);
+
+// Calls fn(arg, block) on each block.
+int utm_pipeline_stage(struct utm_pipeline *pipeline,
+		       utm_stage_fn fn,
+		       void *arg);
+
+// Runs the stages of the pipeline over the points.
+//
+// Inputs:
+// 	exec	Executor running the blocks, or null to run them on the
+// 		calling thread.
+// 	n	Number of points.
+// 	lat	Latitudes of the points, in degrees.
+// 	lon	Longitudes of the points, in degrees.
+// 	block	Number of points per block, or zero for as many as fit in
+// 		half of the L2 cache.
+//
+// Returns:
+// 	The number of points which could not be projected, or -1 if the
+// 	arguments are invalid or memory is exhausted.
+int utm_pipeline_run(struct utm_pipeline const *pipeline,
+		     struct utm_executor const *exec,
+		     size_t n,
+		     double const *lat,
+		     double const *lon,
+		     size_t block);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
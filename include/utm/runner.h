@@ -0,0 +1,87 @@
+// This file is part of utm.
+
+// (c) Copyright 2019 Miguel Aguiar.
+//
+// This program is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option) any
+// later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU Lesser General Public License for more details.
+
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef UTM_RUNNER_HEADER_GUARD_
+#define UTM_RUNNER_HEADER_GUARD_
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Checkpointed conversion of many files.
+//
+// A manifest lists one "input output" pair of paths per line; empty lines and
+// lines starting with '#' are ignored.  Every input is a text file with one
+// "lat lon" point per line (separated by blanks or a comma), which is
+// converted with lat_lon_to_utm_batch into one "easting northing zone" line
+// of the output.  Lines which cannot be parsed or converted give
+// "nan nan -1", so that output lines always match input lines.
+//
+// Files are converted in chunks of whole lines.  Once the output of a chunk
+// has been synced to disk, the offsets reached in the input and the output
+// are appended to the journal and the journal is synced.  When the same
+// manifest is run again with the same journal, each output is truncated to
+// its last committed offset and the conversion resumes from there, so an
+// interrupted run only redoes the chunks which were in flight.  Files which
+// changed size since their last record are converted from the start, as are
+// those whose records name other paths on their line of the manifest.
+
+// Options of utm_run_manifest.  Zero fields select the defaults.
+struct utm_run_options {
+	int nthreads;	   /* Files converted at once (default: processors) */
+	size_t chunk_size; /* Input bytes per chunk (default: 1 MiB) */
+	int zone;	   /* Zone of all points (default: the zone of each) */
+};
+
+// Counters of a run of utm_run_manifest.
+struct utm_run_stats {
+	size_t files;	      /* Files in the manifest */
+	size_t files_skipped; /* Files already complete in the journal */
+	size_t files_failed;  /* Files which could not be converted */
+	size_t chunks;	      /* Chunks converted by this run */
+	size_t bytes;	      /* Input bytes converted by this run */
+	size_t bytes_resumed; /* Input bytes skipped thanks to the journal */
+	size_t points;	      /* Points converted by this run */
+	size_t points_failed; /* Of which could not be converted */
+};
+
+// Converts the files of a manifest, recording progress in a journal.
+//
+// Inputs:
+// 	manifest	Path of the manifest.
+// 	journal		Path of the journal, created if it does not exist.
+// 	options		Options of the run, or null for the defaults.
+//
+// Outputs:
+// 	stats	Counters of the run, if not null.
+//
+// Returns:
+// 	The number of files which could not be converted, or -1 if the
+// 	manifest or the journal cannot be read, the options are invalid or
+// 	the files cannot be scheduled.
+int utm_run_manifest(char const *manifest,
+		     char const *journal,
+		     struct utm_run_options const *options,
+		     struct utm_run_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,159 @@
+// This file is part of utm.
+
+// (c) Copyright 2019 Miguel Aguiar.
+//
+// This program is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option) any
+// later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU Lesser General Public License for more details.
+
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef UTM_SCHED_HEADER_GUARD_
+#define UTM_SCHED_HEADER_GUARD_
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Work-stealing scheduler used by the parallel conversion routines.
+//
+// Each worker thread owns a deque of index ranges.  A worker splits the range
+// it is about to run in halves, pushing the upper halves onto the bottom of
+// its deque, until the range is no larger than the grain; idle workers steal
+// from the top of a random victim's deque, so they take the largest pending
+// pieces, and sleep when there is nothing to steal, as between calls.  This
+// keeps all cores busy when the cost per index varies by orders of magnitude,
+// where splitting the range statically in equal parts leaves threads idle
+// behind the most expensive part.
+struct utm_sched;
+
+// Function run by the scheduler on the index range [begin, end).  It may be
+// called concurrently from several threads on disjoint ranges.
+typedef void (*utm_range_fn)(void *arg, size_t begin, size_t end);
+
+// Creates a scheduler with nthreads workers, including the calling thread,
+// which takes part in every parallel call.  If nthreads is zero, the number of
+// workers of the tuning configuration in use is used (see utm/tune.h), or the
+// number of online processors if it has none.
+//
+// Returns:
+// 	The scheduler, or null if it could not be created.
+struct utm_sched *utm_sched_create(int nthreads);
+
+// Stops the worker threads and frees the scheduler.
+void utm_sched_destroy(struct utm_sched *sched);
+
+// Returns the number of workers of the scheduler, or -1 if sched is null.
+int utm_sched_threads(struct utm_sched const *sched);
+
+// Runs fn over [0, n) on the workers of the scheduler and waits for it to
+// complete.  Ranges are split down to at most grain indices (1 if grain is
+// zero).  Calls from different threads on the same scheduler are serialized.
+// fn must not call utm_sched_parallel_for on the same scheduler, which would
+// wait for the call running it: such calls are rejected.
+//
+// Returns:
+// 	Zero, or -1 if sched or fn is null or the call is made from fn on
+// 	the same scheduler.
+int utm_sched_parallel_for(struct utm_sched *sched,
+			   size_t n,
+			   size_t grain,
+			   utm_range_fn fn,
+			   void *arg);
+
+// A conversion job for utm_sched_convert.  Forward jobs read lat and lon and
+// write easting, northing and (if not null) zones, as lat_lon_to_utm_batch
+// does with the zone *zone, or the zone of each point if zone is zero.
+// Inverse jobs read easting and northing and write lat and lon, as
+// utm_to_lat_lon_batch does.
+struct utm_job {
+	int inverse;
+	size_t n;
+	double *lat;
+	double *lon;
+	double *easting;
+	double *northing;
+	int *zones;
+	int zone;
+	int southhemi;
+};
+
+// Runs a set of conversion jobs of arbitrary sizes on the scheduler.  All the
+// points of all jobs are scheduled as a single index space, so a single large
+// job is spread over all workers and many small jobs are batched together.
+//
+// Inputs:
+// 	jobs	The njobs jobs to run.
+// 	grain	Number of points converted per task (0 picks a default).
+//
+// Returns:
+// 	The total number of points which could not be converted, or -1 if
+// 	sched is null, any job is invalid or the call is nested in a task or
+// 	another parallel call on sched.
+int utm_sched_convert(struct utm_sched *sched,
+		      struct utm_job const *jobs,
+		      size_t njobs,
+		      size_t grain);
+
+// Executor on which the parallel batch routines run their tasks, for
+// applications which already have a thread pool or a task scheduler and would
+// be oversubscribed by the threads of a utm_sched.
+//
+// submit queues the task fn(arg, begin, end) on the executor and returns zero,
+// or nonzero if it cannot, in which case the task is run on the calling
+// thread.  wait returns once every task submitted through ctx has run; it is
+// called once by each parallel call, after its last submit, and may run tasks
+// on the calling thread while it waits.  Tasks do not submit further tasks.
+struct utm_executor {
+	int (*submit)(void *ctx,
+		      utm_range_fn fn,
+		      void *arg,
+		      size_t begin,
+		      size_t end);
+	void (*wait)(void *ctx);
+	void *ctx;
+};
+
+// Returns an executor running its tasks on the pthread workers of sched.  The
+// tasks are run when waited for, by utm_sched_parallel_for, and the executor
+// may be shared by threads.  sched must outlive the executor.
+struct utm_executor utm_sched_executor(struct utm_sched *sched);
+
+// Parallel versions of lat_lon_to_utm_batch and utm_to_lat_lon_batch, which
+// convert the points in tasks of grain points (0 picks a default) submitted
+// to an executor.  The arguments and return values are otherwise those of the
+// batch routines, with -1 also returned if exec is null or incomplete.
+int lat_lon_to_utm_batch_parallel(struct utm_executor const *exec,
+				  size_t grain,
+				  size_t n,
+				  double const *lat,
+				  double const *lon,
+				  int const *zone,
+				  double *easting,
+				  double *northing,
+				  int *zones);
+
+int utm_to_lat_lon_batch_parallel(struct utm_executor const *exec,
+				  size_t grain,
+				  size_t n,
+				  double const *easting,
+				  double const *northing,
+				  int zone,
+				  int southhemi,
+				  double *lat,
+				  double *lon);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
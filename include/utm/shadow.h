@@ -0,0 +1,66 @@
+// This file is part of utm.
+
+// (c) Copyright 2019 Miguel Aguiar.
+//
+// This program is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option) any
+// later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU Lesser General Public License for more details.
+
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef UTM_SHADOW_HEADER_GUARD_
+#define UTM_SHADOW_HEADER_GUARD_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Shadow accuracy sampling.
+//
+// While enabled, a random sample of the points converted by
+// lat_lon_to_utm_batch and lat_lon_to_utm_batch_dd is queued and converted
+// again by a background thread with lat_lon_to_utm, the reference series,
+// and the distance between the two results is accumulated.  Sampling costs a
+// single check per call while disabled and a few operations per sampled
+// point while enabled; if the background thread falls behind, samples are
+// dropped rather than slowing down the conversions.
+
+// Accuracy counters, in meters.
+struct utm_shadow_stats {
+	unsigned long long samples; /* Points re-evaluated */
+	unsigned long long dropped; /* Samples lost to a full queue */
+	double max_error;	    /* Largest discrepancy */
+	double rms_error;	    /* Root mean square discrepancy */
+	double max_lat;		    /* Point of the largest discrepancy */
+	double max_lon;
+};
+
+// Starts sampling on average one in rate points, or changes the rate if
+// sampling is already running.
+//
+// Returns:
+// 	Zero, or -1 if rate is zero or the thread cannot be started.
+int utm_shadow_start(unsigned long rate);
+
+// Stops sampling and waits for the queued samples to be evaluated.  The
+// counters are kept.
+void utm_shadow_stop(void);
+
+// Copies the current counters to stats.
+void utm_shadow_snapshot(struct utm_shadow_stats *stats);
+
+// Clears the counters.
+void utm_shadow_reset(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,128 @@
+// This file is part of utm.
+
+// (c) Copyright 2019 Miguel Aguiar.
+//
+// This program is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option) any
+// later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU Lesser General Public License for more details.
+
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef UTM_TRACK_HEADER_GUARD_
+#define UTM_TRACK_HEADER_GUARD_
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Projects a track to UTM and simplifies it with the Douglas-Peucker
+// algorithm in a single pass, keeping only the vertices needed to stay within
+// tolerance meters of every input point.
+//
+// The track is projected block by block with lat_lon_to_utm_batch into a
+// bounded window, which is simplified and flushed up to its last retained
+// vertex before the next block is read, so no projected copy of the whole
+// track is made.  Every dropped point is within tolerance of the segment of
+// retained vertices around it, as with the plain algorithm; the window may
+// force a few extra vertices on long straight stretches.
+//
+// Inputs:
+// 	n		Number of points of the track.
+// 	lat		Latitudes of the points, in degrees.
+// 	lon		Longitudes of the points, in degrees.
+// 	zone		UTM zone to project the whole track into.  If zone is
+// 			null, the zone of the first valid point is used.
+// 	tolerance	Maximum distance of a dropped point to the simplified
+// 			track, in meters.
+//
+// Outputs:
+// 	x	The eastings of the retained vertices. (in meters)
+// 	y	The northings of the retained vertices. (in meters)
+// 	index	The index in the input of each retained vertex.  May be null.
+// 	count	The number of retained vertices, at most n.
+//
+// Points with a NaN coordinate are skipped; the first and last of the other
+// points are always retained.
+//
+// Returns:
+// 	The zone used, or -1 if any of the required arrays is null, the zone
+// 	is invalid, tolerance is negative or NaN, or no point is valid.
+int utm_track_simplify(size_t n,
+		       double const *lat,
+		       double const *lon,
+		       int const *zone,
+		       double tolerance,
+		       double *easting,
+		       double *northing,
+		       size_t *index,
+		       size_t *count);
+
+// Flags of utm_track_resample.
+enum {
+	UTM_RESAMPLE_HERMITE = 1, /* Cubic Hermite instead of linear */
+};
+
+// Projects a timestamped track to UTM and resamples it at a fixed rate in a
+// single pass.  The fixes are projected block by block with
+// lat_lon_to_utm_batch and the positions at times t0 + k * period are
+// interpolated between the projected fixes around them, linearly, or with
+// UTM_RESAMPLE_HERMITE along cubic Hermite curves whose velocities at the
+// fixes are the finite differences of their neighbours (Catmull-Rom for
+// irregular times), which smooths the turns.
+//
+// Inputs:
+// 	n	Number of fixes.
+// 	t	Times of the fixes, in nondecreasing order.  Of fixes with the
+// 		same time, the first is used.
+// 	lat	Latitudes of the fixes, in degrees.
+// 	lon	Longitudes of the fixes, in degrees.
+// 	zone	UTM zone to project the whole track into.  If zone is null,
+// 		the zone of the first valid fix is used.
+// 	t0	Time of the first output sample; samples before the first fix
+// 		are skipped.
+// 	period	Time between two output samples, positive.
+// 	flags	UTM_RESAMPLE_HERMITE or zero.
+// 	cap	Capacity of the output arrays.
+//
+// Outputs:
+// 	out_t	The times of the samples, within the span of the fixes.
+// 	easting	The eastings of the samples. (in meters)
+// 	northing	The northings of the samples. (in meters)
+// 	count	The number of samples written.  If it equals cap, the track
+// 		may continue after the last sample written.
+//
+// Fixes with a NaN coordinate or time are skipped.
+//
+// Returns:
+// 	The zone used, or -1 if any of the arrays is null, the zone or
+// 	period is invalid, the times decrease or no fix is valid.  The times
+// 	are checked before any sample is written, so nothing is written
+// 	when -1 is returned.
+int utm_track_resample(size_t n,
+		       double const *t,
+		       double const *lat,
+		       double const *lon,
+		       int const *zone,
+		       double t0,
+		       double period,
+		       int flags,
+		       size_t cap,
+		       double *out_t,
+		       double *easting,
+		       double *northing,
+		       size_t *count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
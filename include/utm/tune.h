@@ -0,0 +1,101 @@
+// This file is part of utm.
+
+// (c) Copyright 2019 Miguel Aguiar.
+//
+// This program is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option) any
+// later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU Lesser General Public License for more details.
+
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef UTM_TUNE_HEADER_GUARD_
+#define UTM_TUNE_HEADER_GUARD_
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Host specific tuning of the conversion routines.
+//
+// utm_autotune times the alternatives on the running host: the kernel of the
+// batch conversions (summing the meridian arc and footpoint series, or
+// interpolating them from tables, see utm_set_arc_tables), the number of
+// workers of the scheduler and the grain of utm_sched_convert.  The chosen
+// configuration is saved to a small text file, which is loaded on the first
+// use of the batch and parallel conversions, the scheduler or the functions
+// below.  Once a configuration is in use, its kernel is selected, unless the
+// application chose one with utm_set_arc_tables, and schedulers created with
+// zero threads and conversions with a zero grain use its values.
+//
+// The default file is $UTM_TUNE_FILE, or $HOME/.utm-tune if that is not set.
+// If UTM_TUNE_FILE is set to an empty string, there is no default file.
+
+// Kernels of the batch conversions
+enum utm_kernel {
+	UTM_KERNEL_SERIES = 0, /* Series summed for every point */
+	UTM_KERNEL_TABLES = 1, /* Series interpolated from tables */
+};
+
+// A configuration.  Zero threads or grain select the built-in defaults.
+struct utm_tune_config {
+	int kernel;	/* enum utm_kernel */
+	int nthreads;	/* Workers of schedulers created with zero threads */
+	size_t grain;	/* Points per task of utm_sched_convert */
+};
+
+// Times the alternatives on this host and returns the fastest configuration.
+// It takes a few tenths of a second per thread count tried.  The configuration
+// in use is not changed.
+//
+// Outputs:
+// 	config	The fastest configuration.
+//
+// Returns:
+// 	Zero, or -1 if config is null or the timings could not be run.
+int utm_autotune(struct utm_tune_config *config);
+
+// Makes a configuration the one in use by the batch routines and the
+// scheduler.  Its kernel replaces any set with utm_set_arc_tables.
+//
+// Returns:
+// 	Zero, or -1 if config is null or invalid.
+int utm_tune_apply(struct utm_tune_config const *config);
+
+// Loads a saved configuration, from the default file if path is null, and
+// makes it the one in use in place of the one loaded on first use.  A kernel
+// set earlier with utm_set_arc_tables is kept.
+//
+// Returns:
+// 	Zero, or -1 if the file cannot be read or is invalid, in which case
+// 	the configuration in use is not changed.
+int utm_tune_use_saved(char const *path);
+
+// Saves or loads a configuration.  If path is null, the file described above
+// is used.
+//
+// Returns:
+// 	Zero, or -1 if the file cannot be written or read, or is invalid.
+int utm_tune_save(char const *path, struct utm_tune_config const *config);
+int utm_tune_load(char const *path, struct utm_tune_config *config);
+
+// Returns the configuration in use, with the kernel actually selected.
+void utm_tune_current(struct utm_tune_config *config);
+
+// Returns the name of the kernel of the batch conversions in use, "series" or
+// "tables".
+char const *utm_tune_kernel(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -24,6 +24,9 @@
 #ifndef UTM_HEADER_GUARD_
 #define UTM_HEADER_GUARD_
 
+#include <stddef.h>
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -70,6 +73,466 @@ int utm_to_lat_lon(double easting,
 		   double *lat,
 		   double *lon);
 
+// Converts n latitude/longitude pairs to UTM coordinates.  This gives the same
+// results as calling lat_lon_to_utm on each point, but the ellipsoid
+// constants are computed once per call and the series are evaluated with a
+// single sine and cosine per point, which makes it considerably faster for
+// large inputs.
+//
+// Inputs:
+// 	n	Number of points.
+// 	lat	Latitudes of the points, in degrees.
+// 	lon	Longitudes of the points, in degrees.
+// 	zone	UTM zone to be used for all points.  If zone is null, the
+// 		routine will determine the appropriate zone of each point from
+// 		its longitude.
+//
+// Outputs:
+// 	x	The eastings of the computed points. (in meters)
+// 	y	The northings of the computed points. (in meters)
+// 	zones	The UTM zone of each point, or -1 if it could not be
+// 		converted.  May be null.
+//
+// Returns:
+// 	The number of points which could not be converted (their easting and
+// 	northing are set to NaN), or -1 if lat, lon, x or y is null or the
+// 	passed zone is invalid.
+int lat_lon_to_utm_batch(size_t n,
+			 double const *lat,
+			 double const *lon,
+			 int const *zone,
+			 double *easting,
+			 double *northing,
+			 int *zones);
+
+// Same as lat_lon_to_utm_batch, but with the leading terms of the series and
+// all the sums evaluated in double-double arithmetic, so that the rounding
+// error of the result is about one unit in the last place of the returned
+// doubles (2 nanometers for northings near 10000 km).  This only removes the
+// rounding error of the evaluation; the truncation error of the series is
+// unchanged.  See "bench -k batch-fwd-dd" for its cost.
+int lat_lon_to_utm_batch_dd(size_t n,
+			    double const *lat,
+			    double const *lon,
+			    int const *zone,
+			    double *easting,
+			    double *northing,
+			    int *zones);
+
+// Converts a latitude/longitude pair to UTM coordinates in each of the given
+// zones.  The latitude dependent terms of the series (including the meridian
+// arc length) are computed once and only the longitude dependent part is
+// evaluated per zone, so this is considerably cheaper than calling
+// lat_lon_to_utm once per zone.
+//
+// Inputs:
+// 	lat	Latitude of the point, in degrees.
+// 	lon	Longitude of the point, in degrees.
+// 	zones	The nzones UTM zones to project the point into.
+//
+// Outputs:
+// 	x	The eastings of the point in each zone. (in meters)
+// 	y	The northings of the point in each zone. (in meters)
+//
+// Returns:
+// 	Zero, or -1 if any of the arrays is null or any zone is invalid.
+int lat_lon_to_utm_multi(double lat,
+			 double lon,
+			 int const *zones,
+			 size_t nzones,
+			 double *easting,
+			 double *northing);
+
+// Converts n latitude/longitude pairs to UTM coordinates in their own zone,
+// as lat_lon_to_utm_batch does, and additionally, for points within
+// overlap_deg of a zone boundary, in the neighbouring zone across it.
+//
+// Inputs:
+// 	overlap_deg	Width of the overlap band on each side of a zone
+// 			boundary, in degrees, in [0,3].
+//
+// Outputs:
+// 	x2	The eastings of the points in the neighbouring zone, or NaN
+// 		for points outside the overlap bands.
+// 	y2	The northings of the points in the neighbouring zone, or NaN.
+// 	zones2	The neighbouring zone of each point, or -1.  May be null.
+//
+// The other arguments and the return value are as for lat_lon_to_utm_batch
+// with a null zone; -1 is also returned if overlap_deg is out of range.
+int lat_lon_to_utm_batch_seam(size_t n,
+			      double const *lat,
+			      double const *lon,
+			      double overlap_deg,
+			      double *easting,
+			      double *northing,
+			      int *zones,
+			      double *easting2,
+			      double *northing2,
+			      int *zones2);
+
+// Flags set by the extended zone conversions for each point.
+enum {
+	UTM_EXT_WIDE = 1,	  /* Projected with the wide-validity engine */
+	UTM_EXT_BEYOND_LIMIT = 2, /* Beyond the hard limit; see below */
+};
+
+// Suggested thresholds for the extended zone conversions, in degrees of
+// longitude from the central meridian.  Within UTM_EXT_SWITCH_DEG the fast
+// series used by lat_lon_to_utm is accurate to better than a millimeter.
+#define UTM_EXT_SWITCH_DEG 3.5
+#define UTM_EXT_LIMIT_DEG 20.0
+
+// Extended zone version of lat_lon_to_utm_batch, for projecting points which
+// may lie several degrees outside the zone given in *zone.  Points within
+// switch_deg of the central meridian are converted with the same series as
+// lat_lon_to_utm_batch; farther points are converted with Krüger's series to
+// sixth order in the third flattening, which stays accurate to a few
+// nanometers up to about 35 degrees from the central meridian.
+//
+// Inputs:
+// 	switch_deg	Longitude difference beyond which the wide-validity
+// 			engine is used, in degrees.
+// 	limit_deg	Longitude difference beyond which points are flagged
+// 			with UTM_EXT_BEYOND_LIMIT, in degrees.  They are still
+// 			converted.
+//
+// Outputs:
+// 	flags	UTM_EXT_* flags of each point.  May be null.
+// 	err	A conservative bound on the projection error of each point,
+// 		in meters, estimated from the magnitude of the first terms
+// 		omitted from the series that converted it (NaN for points
+// 		which could not be converted).  It includes a floor of
+// 		1e-7 m for rounding and the truncation of the meridian arc
+// 		series.  The bound is conservative for switch_deg up to 6
+// 		degrees.  May be null.
+//
+// The other arguments and the return value are as for lat_lon_to_utm_batch;
+// -1 is also returned if either threshold is negative or NaN.
+int lat_lon_to_utm_batch_ext(size_t n,
+			     double const *lat,
+			     double const *lon,
+			     int const *zone,
+			     double switch_deg,
+			     double limit_deg,
+			     double *easting,
+			     double *northing,
+			     int *zones,
+			     unsigned char *flags,
+			     double *err);
+
+// Converts n points in the Universal Transverse Mercator projection to
+// latitude/longitude pairs.  This is the batch counterpart of utm_to_lat_lon.
+//
+// Inputs:
+// 	n		Number of points.
+// 	x		The eastings of the points, in meters.
+// 	y		The northings of the points, in meters.
+// 	zone		The UTM zone in which the points lie.
+// 	southhemi	Greater than zero if the points are in the south
+// 			hemisphere.
+//
+// Outputs:
+// 	lat	The latitudes of the points, in degrees.
+// 	lon	The longitudes of the points, in degrees.
+//
+// Returns:
+// 	Zero, or -1 if any of the arrays is null.
+int utm_to_lat_lon_batch(size_t n,
+			 double const *easting,
+			 double const *northing,
+			 int zone,
+			 int southhemi,
+			 double *lat,
+			 double *lon);
+
+// Number of points per block of the blocked (AoSoA) layout.
+#define UTM_AOSOA_BLOCK 8
+
+// Blocked layout versions of lat_lon_to_utm_batch and utm_to_lat_lon_batch.
+// The coordinates are stored in blocks of UTM_AOSOA_BLOCK points: the first
+// coordinates of the points of a block (latitudes or eastings), followed by
+// their second coordinates (longitudes or northings).  The arrays hold
+// (n + UTM_AOSOA_BLOCK - 1) / UTM_AOSOA_BLOCK whole blocks; the unused lanes of
+// the last block are neither read nor written.  The output may be the same
+// array as the input.
+//
+// Inputs:
+// 	lat_lon		The latitudes and longitudes of the points, in degrees.
+// 	xy		The eastings and northings of the points, in meters.
+//
+// Outputs:
+// 	xy		The eastings and northings of the points, in meters.
+// 	lat_lon		The latitudes and longitudes of the points, in degrees.
+// 	zones		The zone of each point, as a plain array, or -1.  May
+// 			be null.
+//
+// The other arguments and the return values are as for lat_lon_to_utm_batch
+// and utm_to_lat_lon_batch.
+int lat_lon_to_utm_batch_aosoa(size_t n,
+			       double const *lat_lon,
+			       int const *zone,
+			       double *xy,
+			       int *zones);
+
+int utm_to_lat_lon_batch_aosoa(size_t n,
+			       double const *xy,
+			       int zone,
+			       int southhemi,
+			       double *lat_lon);
+
+// Flags of the subset conversions
+enum {
+	UTM_SUBSET_SCATTER = 1, /* Write the outputs of a point at its row */
+};
+
+// Subset versions of lat_lon_to_utm_batch, which convert the rows of the
+// columns lat and lon selected by an index array or a bitmask without
+// copying them out first.  The selected rows are gathered in small blocks,
+// with the rows to come prefetched, so the cost follows the number of rows
+// selected rather than the length of the columns.
+//
+// Inputs:
+// 	n	Number of rows of the columns.
+// 	m	Number of indices.
+// 	index	Rows to convert, each less than n, in any order.
+// 	mask	Bitmask of the rows to convert: row i is selected by bit
+// 		i % 64 of mask[i / 64].  Bits beyond n are ignored.
+// 	flags	UTM_SUBSET_SCATTER or zero.
+//
+// Outputs:
+// 	easting, northing, zones	The outputs of the k-th selected row
+// 					at k, or with UTM_SUBSET_SCATTER at
+// 					its row, leaving the others
+// 					untouched.  zones may be null.
+//
+// The other arguments are as for lat_lon_to_utm_batch.
+//
+// Returns:
+// 	The number of selected rows which could not be converted, or -1 if
+// 	any of the arrays is null, an index is out of range or the zone is
+// 	invalid.
+int lat_lon_to_utm_batch_indexed(size_t n,
+				 double const *lat,
+				 double const *lon,
+				 size_t m,
+				 size_t const *index,
+				 int const *zone,
+				 double *easting,
+				 double *northing,
+				 int *zones,
+				 int flags);
+
+int lat_lon_to_utm_batch_masked(size_t n,
+				double const *lat,
+				double const *lon,
+				uint64_t const *mask,
+				int const *zone,
+				double *easting,
+				double *northing,
+				int *zones,
+				int flags);
+
+// Extended zone version of utm_to_lat_lon_batch.  Points whose longitude,
+// as given by the fast series, is more than switch_deg from the central
+// meridian are converted again with the inverse Krüger series and flagged
+// with UTM_EXT_WIDE in flags, which may be null.
+//
+// Returns:
+// 	Zero, or -1 if any of the arrays is null or switch_deg is negative.
+int utm_to_lat_lon_batch_ext(size_t n,
+			     double const *easting,
+			     double const *northing,
+			     int zone,
+			     int southhemi,
+			     double switch_deg,
+			     double *lat,
+			     double *lon,
+			     unsigned char *flags);
+
+// Vectors attached to the points of lat_lon_to_utm_batch_frame, as parallel
+// arrays.  Null fields are not transformed.
+struct utm_frame_vectors {
+	double *ve;	 /* Velocity east, in meters per second */
+	double *vn;	 /* Velocity north, in meters per second */
+	double *heading; /* Heading, clockwise from north, in degrees */
+	double *cov;	 /* Horizontal covariance, 3 per point: ee, en, nn */
+};
+
+// Converts n latitude/longitude pairs to UTM coordinates as
+// lat_lon_to_utm_batch does, and transforms the vectors attached to them
+// from the true east/north frame into the grid frame.  The meridian
+// convergence and the point scale factor come from the same series
+// evaluation as the position: headings are rotated from true to grid north,
+// and velocities and covariances are rotated and scaled from ground to grid
+// lengths.
+//
+// Inputs:
+// 	in	The vectors of the points in the true frame.  ve and vn are
+// 		either both null or both set.  May be null.
+//
+// Outputs:
+// 	out	The vectors of the points in the grid frame.  Every field set
+// 		in in must be set in out; they may be the same arrays.  Null
+// 		if in is null.
+// 	convergence	Angle from true north to grid north, clockwise, in
+// 			degrees.  May be null.
+// 	scale	Point scale factor, grid over ground distance.  May be null.
+//
+// Points which cannot be converted give NaN in all their outputs.
+//
+// The other arguments and the return value are as for lat_lon_to_utm_batch;
+// -1 is also returned if in and out do not match.
+int lat_lon_to_utm_batch_frame(size_t n,
+			       double const *lat,
+			       double const *lon,
+			       int const *zone,
+			       struct utm_frame_vectors const *in,
+			       double *easting,
+			       double *northing,
+			       int *zones,
+			       struct utm_frame_vectors const *out,
+			       double *convergence,
+			       double *scale);
+
+// Project ground coordinate system.  Ground coordinates are UTM coordinates
+// scaled about an origin by the inverse of the combined factor at the
+// origin, so that near the origin distances between ground coordinates are
+// distances on the ground at the height of the origin.
+struct utm_ground_system {
+	double easting;	 /* Origin, in UTM coordinates */
+	double northing;
+	double factor;	 /* Combined factor at the origin, grid over ground */
+	int zone;
+};
+
+// Converts n latitude/longitude pairs with ellipsoidal heights to UTM
+// coordinates as lat_lon_to_utm_batch does, and computes the combined factor
+// of each point in the same pass: the point scale factor of the projection
+// times the elevation factor R / (R + h), where R is the Gaussian mean radius
+// of curvature at the point.
+//
+// Inputs:
+// 	height	Ellipsoidal heights of the points, in meters.  If null, the
+// 		points are taken on the ellipsoid.
+// 	sys	Ground system in which to return the coordinates.  Its zone
+// 		is used for all the points.  May be null.
+//
+// Outputs:
+// 	easting, northing	UTM coordinates of the points, or ground
+// 				coordinates if sys is not null.
+// 	combined	Combined factors of the points, grid over ground
+// 			distance.  May be null.
+//
+// The other arguments and the return value are as for lat_lon_to_utm_batch;
+// if sys is not null, zone is ignored.
+int lat_lon_to_utm_batch_ground(size_t n,
+				double const *lat,
+				double const *lon,
+				double const *height,
+				int const *zone,
+				struct utm_ground_system const *sys,
+				double *easting,
+				double *northing,
+				int *zones,
+				double *combined);
+
+// Sets up the ground system whose origin is at the given point, in the zone
+// *zone (or the zone of the point if zone is null).
+//
+// Returns:
+// 	The zone of the system, or -1 if sys is null or the point cannot be
+// 	converted.
+int utm_ground_system_init(struct utm_ground_system *sys,
+			   double lat,
+			   double lon,
+			   double height,
+			   int const *zone);
+
+// Converts n points between UTM and ground coordinates of the system sys.
+// The outputs may be the same arrays as the inputs.
+//
+// Returns:
+// 	Zero, or -1 if sys or any of the arrays is null.
+int utm_grid_to_ground(struct utm_ground_system const *sys,
+		       size_t n,
+		       double const *easting,
+		       double const *northing,
+		       double *ground_easting,
+		       double *ground_northing);
+int utm_ground_to_grid(struct utm_ground_system const *sys,
+		       size_t n,
+		       double const *ground_easting,
+		       double const *ground_northing,
+		       double *easting,
+		       double *northing);
+
+// Precomputed UTM projection for one zone and hemisphere, with its central
+// meridian, false northing and ellipsoid series coefficients.  Handles are
+// immutable and valid for the lifetime of the program, so they can be looked
+// up once and shared freely between threads.
+struct utm_projection;
+
+// Resolves an EPSG code to a projection handle.
+//
+// Inputs:
+// 	epsg	32601-32660 (WGS 84 / UTM zones 1N-60N) or
+// 		32701-32760 (WGS 84 / UTM zones 1S-60S).
+//
+// Returns:
+// 	The projection handle, or null if the code is not a WGS 84 UTM zone.
+struct utm_projection const *utm_projection_from_epsg(int epsg);
+
+// Returns the projection handle of a zone and hemisphere, or null if the zone
+// is not in [1,60].  southhemi is greater than zero for the south hemisphere.
+struct utm_projection const *utm_projection_from_zone(int zone, int southhemi);
+
+// Returns the EPSG code, zone or hemisphere (1 if south, 0 if north) of a
+// projection handle, or -1 if proj is null.
+int utm_projection_epsg(struct utm_projection const *proj);
+int utm_projection_zone(struct utm_projection const *proj);
+int utm_projection_southhemi(struct utm_projection const *proj);
+
+// Converts n latitude/longitude pairs to UTM coordinates in the projection
+// proj.  Unlike lat_lon_to_utm, all points are projected into the zone and
+// hemisphere of the handle: points south of the equator get negative
+// northings in a north zone and northings above 10000 km in a south zone.
+//
+// Returns:
+// 	Zero, or -1 if proj or any of the arrays is null.
+int utm_projection_forward(struct utm_projection const *proj,
+			   size_t n,
+			   double const *lat,
+			   double const *lon,
+			   double *easting,
+			   double *northing);
+
+// Converts n points in the projection proj to latitude/longitude pairs.
+//
+// Returns:
+// 	Zero, or -1 if proj or any of the arrays is null.
+int utm_projection_inverse(struct utm_projection const *proj,
+			   size_t n,
+			   double const *easting,
+			   double const *northing,
+			   double *lat,
+			   double *lon);
+
+// Selects whether the meridian arc and footpoint latitude series of all the
+// conversions, scalar and batch, are interpolated from precomputed tables
+// instead of being summed for every point.  The tables are built on first
+// use and shared by all zones and threads; they add an error below 1
+// micrometer to the projected coordinates.  The double-double routine
+// lat_lon_to_utm_batch_dd and the reference of the shadow sampling always sum
+// the series.  Disabled by default; a setting made here is kept when a saved
+// tuning is loaded (see utm/tune.h).
+//
+// Returns:
+// 	The previous setting, 1 if the tables were enabled and 0 if not.
+int utm_set_arc_tables(int enable);
+
+// Returns 1 if the tables of utm_set_arc_tables are enabled, 0 if not.
+int utm_get_arc_tables(void);
+
 #ifdef __cplusplus
 }
 #endif
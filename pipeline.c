@@ -0,0 +1,366 @@
+// This file is part of utm.
+
+// (c) Copyright 2019 Miguel Aguiar.
+//
+// This program is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option) any
+// later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU Lesser General Public License for more details.
+
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#define _XOPEN_SOURCE 700
+#include <math.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "utm/pipeline.h"
+#include "utm/utm.h"
+
+// Blocks run by each task, which reuses its scratch columns for all of them
+#define BLOCKS_PER_TASK 8
+
+// L2 cache size assumed if the system does not tell
+#define DEFAULT_L2 (1 << 20)
+
+// Columns written by the stages
+enum {
+	COL_PROJECTED = 1,
+	COL_QUANTIZED = 2,
+	COL_KEY = 4,
+};
+
+enum stage_kind {
+	STAGE_PROJECT,
+	STAGE_QUANTIZE,
+	STAGE_KEY,
+	STAGE_BIN,
+	STAGE_CALLBACK,
+};
+
+struct stage {
+	enum stage_kind kind;
+	union {
+		struct {
+			int zone; /* 0 for the zone of each point */
+		} project;
+		struct {
+			double easting0, northing0, size;
+		} quantize;
+		struct {
+			unsigned bits;
+			unsigned long long *counts;
+		} bin;
+		struct {
+			utm_stage_fn fn;
+			void *arg;
+		} callback;
+	} u;
+};
+
+struct utm_pipeline {
+	struct stage *stages;
+	size_t nstages;
+	size_t cap;
+	int columns; /* Columns written by the stages so far */
+};
+
+struct run {
+	struct utm_pipeline const *pipeline;
+	double const *lat, *lon;
+	size_t block;
+	int failed;
+	int error;
+};
+
+struct utm_pipeline *utm_pipeline_create(void)
+{
+	return calloc(1, sizeof(struct utm_pipeline));
+}
+
+void utm_pipeline_destroy(struct utm_pipeline *p)
+{
+	if (!p)
+		return;
+
+	free(p->stages);
+	free(p);
+}
+
+// Appends a stage reading the columns needs and writing the columns writes.
+static int add_stage(struct utm_pipeline *p,
+		     struct stage const *s,
+		     int needs,
+		     int writes)
+{
+	if (!p || (p->columns & needs) != needs)
+		return -1;
+
+	if (p->nstages == p->cap) {
+		size_t const cap = p->cap ? 2 * p->cap : 8;
+		struct stage *st = realloc(p->stages, cap * sizeof *st);
+		if (!st)
+			return -1;
+		p->stages = st;
+		p->cap = cap;
+	}
+
+	p->stages[p->nstages++] = *s;
+	p->columns |= writes;
+
+	return 0;
+}
+
+int utm_pipeline_project(struct utm_pipeline *p, int const *zone)
+{
+	if (zone && (*zone < 1 || *zone > 60))
+		return -1;
+
+	struct stage const s = {.kind = STAGE_PROJECT,
+				.u.project.zone = zone ? *zone : 0};
+
+	return add_stage(p, &s, 0, COL_PROJECTED);
+}
+
+int utm_pipeline_quantize(struct utm_pipeline *p,
+			  double easting0,
+			  double northing0,
+			  double size)
+{
+	if (!isfinite(easting0) || !isfinite(northing0) || !(size > 0.0) ||
+	    isinf(size))
+		return -1;
+
+	struct stage const s = {.kind = STAGE_QUANTIZE,
+				.u.quantize = {easting0, northing0, size}};
+
+	return add_stage(p, &s, COL_PROJECTED, COL_QUANTIZED);
+}
+
+int utm_pipeline_key(struct utm_pipeline *p)
+{
+	struct stage const s = {.kind = STAGE_KEY};
+
+	return add_stage(p, &s, COL_QUANTIZED, COL_KEY);
+}
+
+int utm_pipeline_bin(struct utm_pipeline *p,
+		     unsigned bits,
+		     unsigned long long *counts)
+{
+	if (bits < 1 || bits > 32 || !counts)
+		return -1;
+
+	struct stage const s = {.kind = STAGE_BIN, .u.bin = {bits, counts}};
+
+	return add_stage(p, &s, COL_KEY, 0);
+}
+
+int utm_pipeline_stage(struct utm_pipeline *p, utm_stage_fn fn, void *arg)
+{
+	if (!fn)
+		return -1;
+
+	struct stage const s = {.kind = STAGE_CALLBACK,
+				.u.callback = {fn, arg}};
+
+	return add_stage(p, &s, 0, 0);
+}
+
+static uint32_t quantize(double v, double origin, double size)
+{
+	double const d = floor((v - origin) / size);
+
+	/* NaN fails the comparison as well. */
+	return d >= 0.0 && d < (double)UTM_QUANT_NONE ? (uint32_t)d
+						       : UTM_QUANT_NONE;
+}
+
+// Spreads the bits of v over the even bits of the result.
+static uint64_t spread(uint32_t v)
+{
+	uint64_t x = v;
+
+	x = (x | x << 16) & 0x0000FFFF0000FFFFull;
+	x = (x | x << 8) & 0x00FF00FF00FF00FFull;
+	x = (x | x << 4) & 0x0F0F0F0F0F0F0F0Full;
+	x = (x | x << 2) & 0x3333333333333333ull;
+	x = (x | x << 1) & 0x5555555555555555ull;
+
+	return x;
+}
+
+// Counts the keys of a block.  Neighbouring points mostly fall in the same
+// bin, so runs of equal bins are added at once, which keeps the atomic
+// additions shared between threads few.
+static void bin(struct utm_block const *b, unsigned bits, unsigned long long *c)
+{
+	unsigned const shift = 64 - bits;
+	uint64_t run_bin = 0;
+	unsigned long long run = 0;
+
+	for (size_t i = 0; i < b->n; ++i) {
+		if (b->key[i] == UTM_KEY_NONE)
+			continue;
+
+		uint64_t const k = b->key[i] >> shift;
+
+		if (run && k != run_bin) {
+			__atomic_fetch_add(&c[run_bin], run, __ATOMIC_RELAXED);
+			run = 0;
+		}
+		run_bin = k;
+		++run;
+	}
+
+	if (run)
+		__atomic_fetch_add(&c[run_bin], run, __ATOMIC_RELAXED);
+}
+
+// Runs all the stages on a block.
+//
+// Returns:
+// 	The number of points of the block which could not be projected.
+static int run_block(struct utm_pipeline const *p, struct utm_block *b)
+{
+	int failed = 0;
+
+	for (size_t s = 0; s < p->nstages; ++s) {
+		struct stage const *st = &p->stages[s];
+
+		switch (st->kind) {
+		case STAGE_PROJECT:
+			failed += lat_lon_to_utm_batch(
+			    b->n,
+			    b->lat,
+			    b->lon,
+			    st->u.project.zone ? &st->u.project.zone : NULL,
+			    b->easting,
+			    b->northing,
+			    b->zones);
+			break;
+		case STAGE_QUANTIZE:
+			for (size_t i = 0; i < b->n; ++i) {
+				b->qx[i] = quantize(b->easting[i],
+						    st->u.quantize.easting0,
+						    st->u.quantize.size);
+				b->qy[i] = quantize(b->northing[i],
+						    st->u.quantize.northing0,
+						    st->u.quantize.size);
+			}
+			break;
+		case STAGE_KEY:
+			for (size_t i = 0; i < b->n; ++i)
+				b->key[i] = b->qx[i] == UTM_QUANT_NONE ||
+						    b->qy[i] == UTM_QUANT_NONE
+						? UTM_KEY_NONE
+						: spread(b->qx[i]) |
+						      spread(b->qy[i]) << 1;
+			break;
+		case STAGE_BIN:
+			bin(b, st->u.bin.bits, st->u.bin.counts);
+			break;
+		case STAGE_CALLBACK:
+			st->u.callback.fn(st->u.callback.arg, b);
+			break;
+		}
+	}
+
+	return failed;
+}
+
+// Runs the blocks of [begin, end), with one set of scratch columns.
+static void run_range(void *arg, size_t begin, size_t end)
+{
+	struct run *r = arg;
+	size_t const m = r->block;
+	double *d = malloc(2 * m * sizeof *d);
+	int *zones = malloc(m * sizeof *zones);
+	uint32_t *q = malloc(2 * m * sizeof *q);
+	uint64_t *key = malloc(m * sizeof *key);
+	int failed = 0;
+
+	if (!d || !zones || !q || !key) {
+		__atomic_store_n(&r->error, 1, __ATOMIC_RELAXED);
+		goto out;
+	}
+
+	for (size_t i = begin; i < end; i += m) {
+		struct utm_block b = {.offset = i,
+				      .n = end - i < m ? end - i : m,
+				      .lat = r->lat + i,
+				      .lon = r->lon + i,
+				      .easting = d,
+				      .northing = d + m,
+				      .zones = zones,
+				      .qx = q,
+				      .qy = q + m,
+				      .key = key};
+
+		failed += run_block(r->pipeline, &b);
+	}
+
+	if (failed)
+		__atomic_fetch_add(&r->failed, failed, __ATOMIC_RELAXED);
+
+out:
+	free(d);
+	free(zones);
+	free(q);
+	free(key);
+}
+
+// Points per block filling half of the L2 cache with the inputs and the
+// scratch columns of a block, leaving the other half to the stages.
+static size_t default_block(void)
+{
+	long l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+	size_t const point = 4 * sizeof(double) + sizeof(int) +
+			     2 * sizeof(uint32_t) + sizeof(uint64_t);
+
+	if (l2 <= 0)
+		l2 = DEFAULT_L2;
+
+	size_t const m = (size_t)l2 / 2 / point / 64 * 64;
+
+	return m < 1024 ? 1024 : m;
+}
+
+int utm_pipeline_run(struct utm_pipeline const *p,
+		     struct utm_executor const *exec,
+		     size_t n,
+		     double const *lat,
+		     double const *lon,
+		     size_t block)
+{
+	if (!p || (n && (!lat || !lon)) ||
+	    (exec && (!exec->submit || !exec->wait)))
+		return -1;
+
+	struct run r = {p, lat, lon, block ? block : default_block(), 0, 0};
+
+	if (n && n < r.block)
+		r.block = n;
+
+	if (n <= r.block || !exec) {
+		run_range(&r, 0, n);
+	} else {
+		size_t const task = BLOCKS_PER_TASK * r.block;
+
+		for (size_t begin = 0; begin < n; begin += task) {
+			size_t const end = n - begin < task ? n : begin + task;
+
+			if (exec->submit(exec->ctx, run_range, &r, begin, end))
+				run_range(&r, begin, end);
+		}
+		exec->wait(exec->ctx);
+	}
+
+	return r.error ? -1 : r.failed;
+}
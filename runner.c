@@ -0,0 +1,625 @@
+// This file is part of utm.
+
+// (c) Copyright 2019 Miguel Aguiar.
+//
+// This program is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option) any
+// later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU Lesser General Public License for more details.
+
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#define _XOPEN_SOURCE 700
+#define _FILE_OFFSET_BITS 64
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "utm/runner.h"
+#include "utm/sched.h"
+#include "utm/utm.h"
+
+#define DEFAULT_CHUNK_SIZE ((size_t)1 << 20)
+
+// First line of a journal.  Every other line is a record
+// "index input-offset output-offset input-size input output" of a committed
+// chunk of the file on line index (from zero) of the manifest.  The paths
+// cannot hold blanks, since the manifest is split on them.
+#define JOURNAL_MAGIC "utm-journal 2\n"
+#define RECORD_FORMAT "%zu %lld %lld %lld %s %s\n"
+
+// Journals of the previous format, whose records lack the paths.  Their
+// records are dropped.
+#define JOURNAL_MAGIC_1 "utm-journal 1\n"
+
+struct entry {
+	char *input;
+	char *output;
+
+	/* Last record of the file in the journal, if any */
+	int committed;
+	long long in_off;
+	long long out_off;
+	long long in_size;
+};
+
+struct run {
+	struct entry *entries;
+	size_t nentries;
+
+	int zone;
+	size_t chunk_size;
+
+	pthread_mutex_t lock; /* Protects the journal and the stats */
+	int journal;
+	struct utm_run_stats stats;
+};
+
+// Growable buffers of a file being converted.
+struct buffers {
+	char *in;
+	char *out;
+	size_t out_cap;
+	double *lat, *lon, *x, *y;
+	int *zones;
+	size_t points_cap;
+};
+
+static void free_entries(struct entry *e, size_t n)
+{
+	for (size_t i = 0; i < n; ++i) {
+		free(e[i].input);
+		free(e[i].output);
+	}
+	free(e);
+}
+
+static char *next_token(char **s)
+{
+	char *p = *s + strspn(*s, " \t\r\n");
+	size_t const len = strcspn(p, " \t\r\n");
+
+	if (len == 0)
+		return NULL;
+
+	*s = p + len;
+	return strndup(p, len);
+}
+
+static int read_manifest(struct run *run, char const *path)
+{
+	FILE *f = fopen(path, "r");
+	if (!f)
+		return -1;
+
+	char *line = NULL;
+	size_t line_cap = 0, cap = 0;
+	int ret = 0;
+
+	while (getline(&line, &line_cap, f) > 0) {
+		char *s = line + strspn(line, " \t");
+
+		if (*s == '#' || *s == '\n' || *s == '\r' || *s == '\0')
+			continue;
+
+		if (run->nentries == cap) {
+			size_t const ncap = cap ? 2 * cap : 64;
+			struct entry *e =
+			    realloc(run->entries, ncap * sizeof *e);
+			if (!e) {
+				ret = -1;
+				break;
+			}
+			run->entries = e;
+			cap = ncap;
+		}
+
+		struct entry *e = &run->entries[run->nentries];
+
+		memset(e, 0, sizeof *e);
+		e->input = next_token(&s);
+		e->output = next_token(&s);
+		++run->nentries;
+
+		if (!e->input || !e->output || next_token(&s)) {
+			errno = EINVAL;
+			ret = -1;
+			break;
+		}
+	}
+
+	if (ferror(f))
+		ret = -1;
+
+	free(line);
+	fclose(f);
+
+	return ret;
+}
+
+// Whether paths, the "input output" end of a record, are those of e.
+static int same_paths(struct entry const *e, char const *paths)
+{
+	size_t const len = strlen(e->input);
+
+	return !strncmp(paths, e->input, len) && paths[len] == ' ' &&
+	       !strcmp(paths + len + 1, e->output);
+}
+
+// Reads the records of an existing journal, drops a torn last record and
+// opens the journal for appending, creating it if needed.  Records of paths
+// which are not on their line of the manifest are kept but not used.
+static int open_journal(struct run *run, char const *path)
+{
+	FILE *f = fopen(path, "r");
+	long valid = 0;
+
+	if (f) {
+		char *line = NULL;
+		size_t cap = 0;
+		ssize_t len;
+
+		len = getline(&line, &cap, f);
+		if (len < 0 || (strcmp(line, JOURNAL_MAGIC) &&
+				strcmp(line, JOURNAL_MAGIC_1))) {
+			free(line);
+			fclose(f);
+			errno = EINVAL;
+			return -1;
+		}
+		if (!strcmp(line, JOURNAL_MAGIC))
+			valid = (long)len;
+		else
+			len = 0; /* Rewritten below */
+
+		while (len > 0 && (len = getline(&line, &cap, f)) > 0) {
+			size_t idx;
+			long long in_off, out_off, in_size;
+			int paths = 0;
+
+			if (line[len - 1] != '\n' ||
+			    sscanf(line,
+				   "%zu %lld %lld %lld %n",
+				   &idx,
+				   &in_off,
+				   &out_off,
+				   &in_size,
+				   &paths) != 4 ||
+			    !paths || idx >= run->nentries)
+				break;
+
+			valid += (long)len;
+			line[len - 1] = '\0';
+			if (!same_paths(&run->entries[idx], line + paths))
+				continue;
+
+			run->entries[idx].committed = 1;
+			run->entries[idx].in_off = in_off;
+			run->entries[idx].out_off = out_off;
+			run->entries[idx].in_size = in_size;
+		}
+
+		free(line);
+		fclose(f);
+	} else if (errno != ENOENT) {
+		return -1;
+	}
+
+	run->journal = open(path, O_WRONLY | O_CREAT | O_APPEND, 0666);
+	if (run->journal < 0)
+		return -1;
+
+	if (valid == 0) {
+		if (ftruncate(run->journal, 0) ||
+		    write(run->journal, JOURNAL_MAGIC, strlen(JOURNAL_MAGIC)) !=
+			(ssize_t)strlen(JOURNAL_MAGIC))
+			goto fail;
+	} else if (ftruncate(run->journal, valid)) {
+		goto fail;
+	}
+
+	if (fsync(run->journal))
+		goto fail;
+
+	return 0;
+
+fail:
+	close(run->journal);
+	run->journal = -1;
+	return -1;
+}
+
+static int full_pread(int fd, char *buf, size_t len, off_t off)
+{
+	while (len) {
+		ssize_t const got = pread(fd, buf, len, off);
+
+		if (got < 0 && errno == EINTR)
+			continue;
+		if (got <= 0)
+			return -1;
+
+		buf += got;
+		len -= (size_t)got;
+		off += got;
+	}
+
+	return 0;
+}
+
+static int full_pwrite(int fd, char const *buf, size_t len, off_t off)
+{
+	while (len) {
+		ssize_t const put = pwrite(fd, buf, len, off);
+
+		if (put < 0 && errno == EINTR)
+			continue;
+		if (put <= 0)
+			return -1;
+
+		buf += put;
+		len -= (size_t)put;
+		off += put;
+	}
+
+	return 0;
+}
+
+static int reserve_points(struct buffers *b, size_t n)
+{
+	if (n <= b->points_cap)
+		return 0;
+
+	double *lat = realloc(b->lat, n * sizeof *lat);
+	if (lat)
+		b->lat = lat;
+	double *lon = realloc(b->lon, n * sizeof *lon);
+	if (lon)
+		b->lon = lon;
+	double *x = realloc(b->x, n * sizeof *x);
+	if (x)
+		b->x = x;
+	double *y = realloc(b->y, n * sizeof *y);
+	if (y)
+		b->y = y;
+	int *zones = realloc(b->zones, n * sizeof *zones);
+	if (zones)
+		b->zones = zones;
+
+	if (!lat || !lon || !x || !y || !zones)
+		return -1;
+
+	b->points_cap = n;
+	return 0;
+}
+
+// Parses the lines of buf, of which all but the last end with a newline.
+static size_t parse_points(struct buffers *b, char const *buf, size_t len)
+{
+	size_t n = 0;
+	char const *end = buf + len;
+
+	while (buf < end) {
+		char const *eol = memchr(buf, '\n', (size_t)(end - buf));
+		char line[128];
+		size_t l = eol ? (size_t)(eol - buf) : (size_t)(end - buf);
+		char *s, *t;
+
+		/* No coordinate pair needs more; only parse the start. */
+		if (l >= sizeof line)
+			l = sizeof line - 1;
+		memcpy(line, buf, l);
+		line[l] = '\0';
+
+		b->lat[n] = strtod(line, &s);
+		t = s + strspn(s, " \t,");
+		b->lon[n] = strtod(t, &t);
+		if (s == line || t == s + strspn(s, " \t,"))
+			b->lat[n] = NAN;
+
+		++n;
+		buf = eol ? eol + 1 : end;
+	}
+
+	return n;
+}
+
+static int format_points(struct buffers *b, size_t n, size_t *len)
+{
+	size_t pos = 0;
+
+	for (size_t i = 0; i < n; ++i) {
+		for (;;) {
+			int w;
+
+			if (b->zones[i] < 0)
+				w = snprintf(b->out + pos,
+					     b->out_cap - pos,
+					     "nan nan -1\n");
+			else
+				w = snprintf(b->out + pos,
+					     b->out_cap - pos,
+					     "%.4f %.4f %d\n",
+					     b->x[i],
+					     b->y[i],
+					     b->zones[i]);
+
+			if (w < 0)
+				return -1;
+			if ((size_t)w < b->out_cap - pos) {
+				pos += (size_t)w;
+				break;
+			}
+
+			size_t const cap = 2 * b->out_cap + (size_t)w;
+			char *out = realloc(b->out, cap);
+			if (!out)
+				return -1;
+			b->out = out;
+			b->out_cap = cap;
+		}
+	}
+
+	*len = pos;
+	return 0;
+}
+
+static int commit_chunk(struct run *run,
+			size_t idx,
+			long long in_off,
+			long long out_off,
+			long long in_size)
+{
+	struct entry const *e = &run->entries[idx];
+	int const len = snprintf(NULL,
+				 0,
+				 RECORD_FORMAT,
+				 idx,
+				 in_off,
+				 out_off,
+				 in_size,
+				 e->input,
+				 e->output);
+	int ret = -1;
+
+	if (len < 0)
+		return -1;
+
+	/* A single write, so that a torn record is only ever the last. */
+	char *rec = malloc((size_t)len + 1);
+	if (!rec)
+		return -1;
+
+	snprintf(rec,
+		 (size_t)len + 1,
+		 RECORD_FORMAT,
+		 idx,
+		 in_off,
+		 out_off,
+		 in_size,
+		 e->input,
+		 e->output);
+
+	if (write(run->journal, rec, (size_t)len) == len &&
+	    !fsync(run->journal))
+		ret = 0;
+
+	free(rec);
+	return ret;
+}
+
+static int convert_file(struct run *run, size_t idx, struct buffers *b)
+{
+	struct entry const *e = &run->entries[idx];
+	struct stat st;
+	int ret = -1;
+
+	int const in = open(e->input, O_RDONLY);
+	if (in < 0)
+		return -1;
+
+	int const out = open(e->output, O_WRONLY | O_CREAT, 0666);
+	if (out < 0) {
+		close(in);
+		return -1;
+	}
+
+	if (fstat(in, &st))
+		goto done;
+
+	long long const size = (long long)st.st_size;
+	long long in_off = 0, out_off = 0;
+
+	/* Resume from the last committed chunk if the output still has it. */
+	if (e->committed && e->in_size == size && e->in_off <= size) {
+		struct stat ost;
+
+		if (!fstat(out, &ost) && (long long)ost.st_size >= e->out_off) {
+			in_off = e->in_off;
+			out_off = e->out_off;
+		}
+	}
+
+	if (in_off == size && e->committed) {
+		pthread_mutex_lock(&run->lock);
+		++run->stats.files_skipped;
+		run->stats.bytes_resumed += (size_t)in_off;
+		pthread_mutex_unlock(&run->lock);
+		ret = 0;
+		goto done;
+	}
+
+	if (ftruncate(out, (off_t)out_off))
+		goto done;
+
+	pthread_mutex_lock(&run->lock);
+	run->stats.bytes_resumed += (size_t)in_off;
+	pthread_mutex_unlock(&run->lock);
+
+	/* An empty input still gets its (empty) output committed. */
+	do {
+		size_t len = size - in_off < (long long)run->chunk_size
+				 ? (size_t)(size - in_off)
+				 : run->chunk_size;
+
+		if (full_pread(in, b->in, len, (off_t)in_off))
+			goto done;
+
+		/* Cut the chunk after its last complete line. */
+		if (in_off + (long long)len < size) {
+			while (len && b->in[len - 1] != '\n')
+				--len;
+			if (len == 0) {
+				errno = EINVAL; /* Line longer than a chunk */
+				goto done;
+			}
+		}
+
+		size_t lines = 0;
+		for (size_t i = 0; i < len; ++i)
+			lines += b->in[i] == '\n';
+		if (len && b->in[len - 1] != '\n')
+			++lines;
+
+		if (reserve_points(b, lines))
+			goto done;
+
+		size_t const n = parse_points(b, b->in, len);
+		int const failed = lat_lon_to_utm_batch(n,
+							b->lat,
+							b->lon,
+							run->zone ? &run->zone
+								  : NULL,
+							b->x,
+							b->y,
+							b->zones);
+		size_t out_len;
+
+		if (failed < 0 || format_points(b, n, &out_len) ||
+		    full_pwrite(out, b->out, out_len, (off_t)out_off) ||
+		    fsync(out))
+			goto done;
+
+		in_off += (long long)len;
+		out_off += (long long)out_len;
+
+		pthread_mutex_lock(&run->lock);
+		int const err = commit_chunk(run, idx, in_off, out_off, size);
+		if (!err) {
+			++run->stats.chunks;
+			run->stats.bytes += len;
+			run->stats.points += n;
+			run->stats.points_failed += (size_t)failed;
+		}
+		pthread_mutex_unlock(&run->lock);
+
+		if (err)
+			goto done;
+	} while (in_off < size);
+
+	ret = 0;
+
+done:
+	close(out);
+	close(in);
+
+	return ret;
+}
+
+static void convert_files(void *arg, size_t begin, size_t end)
+{
+	struct run *run = arg;
+	struct buffers b = {0};
+
+	b.in = malloc(run->chunk_size);
+	if (!b.in) {
+		pthread_mutex_lock(&run->lock);
+		run->stats.files_failed += end - begin;
+		pthread_mutex_unlock(&run->lock);
+		return;
+	}
+
+	for (size_t i = begin; i < end; ++i) {
+		if (!convert_file(run, i, &b))
+			continue;
+
+		pthread_mutex_lock(&run->lock);
+		++run->stats.files_failed;
+		pthread_mutex_unlock(&run->lock);
+	}
+
+	free(b.in);
+	free(b.out);
+	free(b.lat);
+	free(b.lon);
+	free(b.x);
+	free(b.y);
+	free(b.zones);
+}
+
+int utm_run_manifest(char const *manifest,
+		     char const *journal,
+		     struct utm_run_options const *options,
+		     struct utm_run_stats *stats)
+{
+	struct utm_run_options const defaults = {0, 0, 0};
+	struct run run;
+	int ret = -1;
+
+	if (!manifest || !journal)
+		return -1;
+
+	if (!options)
+		options = &defaults;
+
+	if (options->nthreads < 0 || options->zone < 0 || options->zone > 60)
+		return -1;
+
+	memset(&run, 0, sizeof run);
+	run.zone = options->zone;
+	run.chunk_size =
+	    options->chunk_size ? options->chunk_size : DEFAULT_CHUNK_SIZE;
+	run.journal = -1;
+
+	if (read_manifest(&run, manifest) || open_journal(&run, journal))
+		goto out;
+
+	run.stats.files = run.nentries;
+
+	/* Files are the tasks: large ones do not hold up the small ones. */
+	struct utm_sched *sched = utm_sched_create(options->nthreads);
+	if (!sched)
+		goto out;
+
+	pthread_mutex_init(&run.lock, NULL);
+	int const err =
+	    utm_sched_parallel_for(sched, run.nentries, 1, convert_files, &run);
+	pthread_mutex_destroy(&run.lock);
+	utm_sched_destroy(sched);
+
+	if (err)
+		goto out;
+
+	if (stats)
+		*stats = run.stats;
+	ret = (int)run.stats.files_failed;
+
+out:
+	if (run.journal >= 0)
+		close(run.journal);
+	free_entries(run.entries, run.nentries);
+
+	return ret;
+}
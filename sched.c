@@ -0,0 +1,712 @@
+// This file is part of utm.
+
+// (c) Copyright 2019 Miguel Aguiar.
+//
+// This program is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option) any
+// later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU Lesser General Public License for more details.
+
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#define _XOPEN_SOURCE 700
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "tune.h"
+#include "utm/sched.h"
+#include "utm/utm.h"
+
+// Capacity of each deque.  A worker pushes at most log2(n / grain) halves
+// before running a range, so this is only reached for absurd grain sizes, in
+// which case the range is run without splitting further.
+#define DEQUE_CAP 128
+
+// Default number of points per task of utm_sched_convert
+#define CONVERT_GRAIN 4096
+
+struct range {
+	size_t begin;
+	size_t end;
+};
+
+// Deque of ranges.  The owner pushes and pops at the bottom (tail); thieves
+// take from the top (head).  Accesses are rare compared with the work in a
+// range, so a mutex is cheap enough here.
+struct deque {
+	pthread_mutex_t lock;
+	size_t head;
+	size_t tail;
+	struct range buf[DEQUE_CAP];
+};
+
+// Task submitted through the executor of a scheduler
+struct task {
+	utm_range_fn fn;
+	void *arg;
+	size_t begin;
+	size_t end;
+};
+
+struct worker {
+	struct utm_sched *sched;
+	pthread_t thread;
+	int index;
+	uint64_t rng;
+	struct deque deque;
+};
+
+struct utm_sched {
+	int nthreads;
+	struct worker *workers;
+
+	pthread_mutex_t run_lock; /* Serializes parallel calls */
+
+	pthread_mutex_t lock;	  /* Protects the fields below */
+	pthread_cond_t work_cv;	  /* Signalled when a job is posted */
+	pthread_cond_t done_cv;	  /* Signalled when a job completes */
+	pthread_cond_t idle_cv;	  /* Signalled when a range is pushed */
+	unsigned long generation; /* Incremented for every job */
+	unsigned long pushes;	  /* Incremented for every range pushed */
+	size_t remaining;	  /* Indices of the current job not yet run */
+	int stop;
+	int busy;	/* Whether a parallel call is running */
+	pthread_t caller; /* Thread of the parallel call running */
+
+	/* Current job; written before its first range is pushed */
+	utm_range_fn fn;
+	void *arg;
+	size_t grain;
+
+	pthread_mutex_t exec_lock; /* Protects the fields below */
+	pthread_cond_t exec_cv;	   /* Signalled when tasks have run */
+	struct task *tasks;	   /* Submitted tasks not yet taken by a wait */
+	size_t ntasks;
+	size_t tasks_cap;
+	size_t outstanding; /* Submitted tasks not yet run */
+};
+
+static int deque_push(struct deque *d, struct range r)
+{
+	int ok = 0;
+
+	pthread_mutex_lock(&d->lock);
+	if (d->tail - d->head < DEQUE_CAP) {
+		d->buf[d->tail++ % DEQUE_CAP] = r;
+		ok = 1;
+	}
+	pthread_mutex_unlock(&d->lock);
+
+	return ok;
+}
+
+static int deque_pop(struct deque *d, struct range *r)
+{
+	int ok = 0;
+
+	pthread_mutex_lock(&d->lock);
+	if (d->tail > d->head) {
+		*r = d->buf[--d->tail % DEQUE_CAP];
+		ok = 1;
+	}
+	pthread_mutex_unlock(&d->lock);
+
+	return ok;
+}
+
+static int deque_steal(struct deque *d, struct range *r)
+{
+	int ok = 0;
+
+	pthread_mutex_lock(&d->lock);
+	if (d->tail > d->head) {
+		*r = d->buf[d->head++ % DEQUE_CAP];
+		ok = 1;
+	}
+	pthread_mutex_unlock(&d->lock);
+
+	return ok;
+}
+
+static int steal(struct worker *w, struct range *r)
+{
+	struct utm_sched *s = w->sched;
+	int const n = s->nthreads;
+
+	if (n < 2)
+		return 0;
+
+	w->rng ^= w->rng << 13;
+	w->rng ^= w->rng >> 7;
+	w->rng ^= w->rng << 17;
+
+	int const start = (int)(w->rng % (uint64_t)n);
+
+	for (int i = 0; i < n; ++i) {
+		int const victim = (start + i) % n;
+
+		if (victim != w->index &&
+		    deque_steal(&s->workers[victim].deque, r))
+			return 1;
+	}
+
+	return 0;
+}
+
+// Pushes a range onto a worker's deque and wakes the idle workers.
+static int push(struct worker *w, struct range r)
+{
+	struct utm_sched *s = w->sched;
+
+	if (!deque_push(&w->deque, r))
+		return 0;
+
+	pthread_mutex_lock(&s->lock);
+	++s->pushes;
+	pthread_cond_broadcast(&s->idle_cv);
+	pthread_mutex_unlock(&s->lock);
+
+	return 1;
+}
+
+// Runs a range, first splitting off upper halves onto the worker's deque
+// until it is no larger than the grain.
+static void run_range(struct worker *w, struct range r)
+{
+	struct utm_sched *s = w->sched;
+
+	while (r.end - r.begin > s->grain) {
+		size_t const mid = r.begin + (r.end - r.begin) / 2;
+
+		if (!push(w, (struct range){mid, r.end}))
+			break;
+		r.end = mid;
+	}
+
+	s->fn(s->arg, r.begin, r.end);
+
+	pthread_mutex_lock(&s->lock);
+	s->remaining -= r.end - r.begin;
+	if (s->remaining == 0) {
+		pthread_cond_broadcast(&s->done_cv);
+		pthread_cond_broadcast(&s->idle_cv);
+	}
+	pthread_mutex_unlock(&s->lock);
+}
+
+// Works on the current job until all of it has been run.  A worker finding
+// nothing to steal sleeps until a range is pushed or the job completes: the
+// count of pushes read before looking tells whether one was pushed since.
+static void work(struct worker *w)
+{
+	struct utm_sched *s = w->sched;
+	struct range r;
+
+	for (;;) {
+		pthread_mutex_lock(&s->lock);
+		unsigned long const seen = s->pushes;
+		pthread_mutex_unlock(&s->lock);
+
+		if (deque_pop(&w->deque, &r) || steal(w, &r)) {
+			run_range(w, r);
+			continue;
+		}
+
+		pthread_mutex_lock(&s->lock);
+		while (s->remaining && s->pushes == seen)
+			pthread_cond_wait(&s->idle_cv, &s->lock);
+		int const done = s->remaining == 0;
+		pthread_mutex_unlock(&s->lock);
+
+		if (done)
+			break;
+	}
+}
+
+static void *worker_main(void *arg)
+{
+	struct worker *w = arg;
+	struct utm_sched *s = w->sched;
+	unsigned long seen = 0;
+
+	pthread_mutex_lock(&s->lock);
+	for (;;) {
+		while (!s->stop && s->generation == seen)
+			pthread_cond_wait(&s->work_cv, &s->lock);
+		if (s->stop)
+			break;
+
+		seen = s->generation;
+		pthread_mutex_unlock(&s->lock);
+		work(w);
+		pthread_mutex_lock(&s->lock);
+	}
+	pthread_mutex_unlock(&s->lock);
+
+	return NULL;
+}
+
+struct utm_sched *utm_sched_create(int nthreads)
+{
+	if (nthreads < 0)
+		return NULL;
+
+	if (nthreads == 0) {
+		utm_tune_init();
+		nthreads = utm_tune_threads();
+	}
+
+	if (nthreads == 0) {
+		long const ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+		nthreads = ncpu > 0 ? (int)ncpu : 1;
+	}
+
+	struct utm_sched *s = calloc(1, sizeof *s);
+	if (!s)
+		return NULL;
+
+	s->workers = calloc((size_t)nthreads, sizeof *s->workers);
+	if (!s->workers) {
+		free(s);
+		return NULL;
+	}
+
+	pthread_mutex_init(&s->run_lock, NULL);
+	pthread_mutex_init(&s->lock, NULL);
+	pthread_cond_init(&s->work_cv, NULL);
+	pthread_cond_init(&s->done_cv, NULL);
+	pthread_cond_init(&s->idle_cv, NULL);
+	pthread_mutex_init(&s->exec_lock, NULL);
+	pthread_cond_init(&s->exec_cv, NULL);
+
+	for (int i = 0; i < nthreads; ++i) {
+		struct worker *w = &s->workers[i];
+
+		w->sched = s;
+		w->index = i;
+		w->rng = 0x9E3779B97F4A7C15ull * (uint64_t)(i + 1);
+		pthread_mutex_init(&w->deque.lock, NULL);
+	}
+
+	/* Worker 0 is whichever thread calls utm_sched_parallel_for. */
+	s->nthreads = 1;
+	for (int i = 1; i < nthreads; ++i) {
+		if (pthread_create(&s->workers[i].thread,
+				   NULL,
+				   worker_main,
+				   &s->workers[i]))
+			break;
+		++s->nthreads;
+	}
+
+	return s;
+}
+
+void utm_sched_destroy(struct utm_sched *s)
+{
+	if (!s)
+		return;
+
+	pthread_mutex_lock(&s->lock);
+	s->stop = 1;
+	pthread_cond_broadcast(&s->work_cv);
+	pthread_mutex_unlock(&s->lock);
+
+	for (int i = 1; i < s->nthreads; ++i)
+		pthread_join(s->workers[i].thread, NULL);
+
+	for (int i = 0; i < s->nthreads; ++i)
+		pthread_mutex_destroy(&s->workers[i].deque.lock);
+
+	pthread_cond_destroy(&s->done_cv);
+	pthread_cond_destroy(&s->idle_cv);
+	pthread_cond_destroy(&s->work_cv);
+	pthread_mutex_destroy(&s->lock);
+	pthread_mutex_destroy(&s->run_lock);
+	pthread_cond_destroy(&s->exec_cv);
+	pthread_mutex_destroy(&s->exec_lock);
+
+	free(s->tasks);
+	free(s->workers);
+	free(s);
+}
+
+int utm_sched_threads(struct utm_sched const *s)
+{
+	return s ? s->nthreads : -1;
+}
+
+int utm_sched_parallel_for(
+    struct utm_sched *s, size_t n, size_t grain, utm_range_fn fn, void *arg)
+{
+	if (!s || !fn)
+		return -1;
+
+	/* A call from a task of this scheduler would wait on run_lock for
+	   the call running the task. */
+	pthread_t const self = pthread_self();
+
+	for (int i = 1; i < s->nthreads; ++i)
+		if (pthread_equal(self, s->workers[i].thread))
+			return -1;
+
+	pthread_mutex_lock(&s->lock);
+	int const nested = s->busy && pthread_equal(self, s->caller);
+	pthread_mutex_unlock(&s->lock);
+	if (nested)
+		return -1;
+
+	if (n == 0)
+		return 0;
+
+	pthread_mutex_lock(&s->run_lock);
+
+	s->fn = fn;
+	s->arg = arg;
+	s->grain = grain ? grain : 1;
+
+	pthread_mutex_lock(&s->lock);
+	s->remaining = n;
+	s->busy = 1;
+	s->caller = self;
+	++s->generation;
+	pthread_mutex_unlock(&s->lock);
+
+	push(&s->workers[0], (struct range){0, n});
+
+	pthread_mutex_lock(&s->lock);
+	pthread_cond_broadcast(&s->work_cv);
+	pthread_mutex_unlock(&s->lock);
+
+	work(&s->workers[0]);
+
+	pthread_mutex_lock(&s->lock);
+	while (s->remaining)
+		pthread_cond_wait(&s->done_cv, &s->lock);
+	s->busy = 0;
+	pthread_mutex_unlock(&s->lock);
+
+	pthread_mutex_unlock(&s->run_lock);
+
+	return 0;
+}
+
+struct convert_ctx {
+	struct utm_job const *jobs;
+	size_t njobs;
+	size_t *start; /* start[j] is the first index of job j */
+	pthread_mutex_t lock;
+	int failed;
+};
+
+static int job_valid(struct utm_job const *job)
+{
+	if (job->n == 0)
+		return 1;
+
+	if (!job->lat || !job->lon || !job->easting || !job->northing)
+		return 0;
+
+	if (job->inverse)
+		return job->zone >= 1 && job->zone <= 60;
+
+	return job->zone >= 0 && job->zone <= 60;
+}
+
+static void convert_range(void *arg, size_t begin, size_t end)
+{
+	struct convert_ctx *ctx = arg;
+
+	/* Find the job containing begin. */
+	size_t lo = 0, hi = ctx->njobs;
+	while (hi - lo > 1) {
+		size_t const mid = lo + (hi - lo) / 2;
+
+		if (ctx->start[mid] <= begin)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	int failed = 0;
+
+	for (size_t j = lo; begin < end; ++j) {
+		struct utm_job const *job = &ctx->jobs[j];
+		size_t const off = begin - ctx->start[j];
+		size_t const jend = ctx->start[j + 1] < end ? ctx->start[j + 1]
+							     : end;
+		size_t const cnt = jend - begin;
+
+		if (cnt == 0)
+			continue;
+
+		if (job->inverse)
+			utm_to_lat_lon_batch(cnt,
+					     job->easting + off,
+					     job->northing + off,
+					     job->zone,
+					     job->southhemi,
+					     job->lat + off,
+					     job->lon + off);
+		else
+			failed += lat_lon_to_utm_batch(
+			    cnt,
+			    job->lat + off,
+			    job->lon + off,
+			    job->zone ? &job->zone : NULL,
+			    job->easting + off,
+			    job->northing + off,
+			    job->zones ? job->zones + off : NULL);
+
+		begin = jend;
+	}
+
+	if (failed) {
+		pthread_mutex_lock(&ctx->lock);
+		ctx->failed += failed;
+		pthread_mutex_unlock(&ctx->lock);
+	}
+}
+
+int utm_sched_convert(struct utm_sched *s,
+		      struct utm_job const *jobs,
+		      size_t njobs,
+		      size_t grain)
+{
+	if (!s || (njobs && !jobs))
+		return -1;
+
+	for (size_t j = 0; j < njobs; ++j)
+		if (!job_valid(&jobs[j]))
+			return -1;
+
+	if (grain == 0) {
+		utm_tune_init();
+		grain = utm_tune_grain();
+	}
+
+	struct convert_ctx ctx;
+
+	ctx.jobs = jobs;
+	ctx.njobs = njobs;
+	ctx.failed = 0;
+	ctx.start = malloc((njobs + 1) * sizeof *ctx.start);
+	if (!ctx.start)
+		return -1;
+
+	pthread_mutex_init(&ctx.lock, NULL);
+
+	ctx.start[0] = 0;
+	for (size_t j = 0; j < njobs; ++j)
+		ctx.start[j + 1] = ctx.start[j] + jobs[j].n;
+
+	int const ret = utm_sched_parallel_for(s,
+					       ctx.start[njobs],
+					       grain ? grain : CONVERT_GRAIN,
+					       convert_range,
+					       &ctx);
+
+	free(ctx.start);
+	pthread_mutex_destroy(&ctx.lock);
+
+	return ret ? -1 : ctx.failed;
+}
+
+static int sched_submit(
+    void *ctx, utm_range_fn fn, void *arg, size_t begin, size_t end)
+{
+	struct utm_sched *s = ctx;
+	int ret = 0;
+
+	pthread_mutex_lock(&s->exec_lock);
+	if (s->ntasks == s->tasks_cap) {
+		size_t const cap = s->tasks_cap ? 2 * s->tasks_cap : 64;
+		struct task *t = realloc(s->tasks, cap * sizeof *t);
+
+		if (t) {
+			s->tasks = t;
+			s->tasks_cap = cap;
+		}
+	}
+	if (s->ntasks < s->tasks_cap) {
+		s->tasks[s->ntasks++] = (struct task){fn, arg, begin, end};
+		++s->outstanding;
+	} else {
+		ret = -1;
+	}
+	pthread_mutex_unlock(&s->exec_lock);
+
+	return ret;
+}
+
+static void run_tasks(void *arg, size_t begin, size_t end)
+{
+	struct task const *t = arg;
+
+	for (size_t i = begin; i < end; ++i)
+		t[i].fn(t[i].arg, t[i].begin, t[i].end);
+}
+
+// Runs the submitted tasks until none is left.  Tasks taken by a concurrent
+// wait are waited for, as they may have been submitted by this thread.
+static void sched_wait(void *ctx)
+{
+	struct utm_sched *s = ctx;
+
+	pthread_mutex_lock(&s->exec_lock);
+	for (;;) {
+		if (s->ntasks) {
+			struct task *t = s->tasks;
+			size_t const n = s->ntasks;
+
+			s->tasks = NULL;
+			s->ntasks = s->tasks_cap = 0;
+			pthread_mutex_unlock(&s->exec_lock);
+
+			/* Nested in a task of the scheduler, the tasks are
+			   run here. */
+			if (utm_sched_parallel_for(s, n, 1, run_tasks, t))
+				run_tasks(t, 0, n);
+			free(t);
+
+			pthread_mutex_lock(&s->exec_lock);
+			s->outstanding -= n;
+			pthread_cond_broadcast(&s->exec_cv);
+		} else if (s->outstanding) {
+			pthread_cond_wait(&s->exec_cv, &s->exec_lock);
+		} else {
+			break;
+		}
+	}
+	pthread_mutex_unlock(&s->exec_lock);
+}
+
+struct utm_executor utm_sched_executor(struct utm_sched *s)
+{
+	return (struct utm_executor){sched_submit, sched_wait, s};
+}
+
+struct batch_ctx {
+	double const *in_x, *in_y;
+	double *out_x, *out_y;
+	int const *zone;
+	int *zones;
+	int inverse_zone;
+	int southhemi;
+	int failed;
+};
+
+static void forward_range(void *arg, size_t begin, size_t end)
+{
+	struct batch_ctx *ctx = arg;
+	int const failed = lat_lon_to_utm_batch(end - begin,
+						ctx->in_x + begin,
+						ctx->in_y + begin,
+						ctx->zone,
+						ctx->out_x + begin,
+						ctx->out_y + begin,
+						ctx->zones ? ctx->zones + begin
+							   : NULL);
+
+	if (failed)
+		__atomic_fetch_add(&ctx->failed, failed, __ATOMIC_RELAXED);
+}
+
+static void inverse_range(void *arg, size_t begin, size_t end)
+{
+	struct batch_ctx *ctx = arg;
+
+	utm_to_lat_lon_batch(end - begin,
+			     ctx->in_x + begin,
+			     ctx->in_y + begin,
+			     ctx->inverse_zone,
+			     ctx->southhemi,
+			     ctx->out_x + begin,
+			     ctx->out_y + begin);
+}
+
+// Submits [0, n) to the executor in tasks of grain indices and waits for
+// them.  Tasks which cannot be submitted are run on the calling thread.
+static void run_on(struct utm_executor const *exec,
+		   size_t n,
+		   size_t grain,
+		   utm_range_fn fn,
+		   void *arg)
+{
+	if (grain == 0) {
+		utm_tune_init();
+		grain = utm_tune_grain();
+	}
+	if (grain == 0)
+		grain = CONVERT_GRAIN;
+
+	for (size_t begin = 0; begin < n; begin += grain) {
+		size_t const end = n - begin < grain ? n : begin + grain;
+
+		if (exec->submit(exec->ctx, fn, arg, begin, end))
+			fn(arg, begin, end);
+	}
+
+	exec->wait(exec->ctx);
+}
+
+int lat_lon_to_utm_batch_parallel(struct utm_executor const *exec,
+				  size_t grain,
+				  size_t n,
+				  double const *lat,
+				  double const *lon,
+				  int const *zone,
+				  double *x,
+				  double *y,
+				  int *zones)
+{
+	if (!exec || !exec->submit || !exec->wait ||
+	    (n && (!lat || !lon || !x || !y)) ||
+	    (zone && (*zone < 1 || *zone > 60)))
+		return -1;
+
+	struct batch_ctx ctx = {.in_x = lat,
+				.in_y = lon,
+				.out_x = x,
+				.out_y = y,
+				.zone = zone,
+				.zones = zones};
+
+	run_on(exec, n, grain, forward_range, &ctx);
+
+	return ctx.failed;
+}
+
+int utm_to_lat_lon_batch_parallel(struct utm_executor const *exec,
+				  size_t grain,
+				  size_t n,
+				  double const *x,
+				  double const *y,
+				  int zone,
+				  int southhemi,
+				  double *lat,
+				  double *lon)
+{
+	if (!exec || !exec->submit || !exec->wait ||
+	    (n && (!x || !y || !lat || !lon)))
+		return -1;
+
+	struct batch_ctx ctx = {.in_x = x,
+				.in_y = y,
+				.out_x = lat,
+				.out_y = lon,
+				.inverse_zone = zone,
+				.southhemi = southhemi};
+
+	run_on(exec, n, grain, inverse_range, &ctx);
+
+	return 0;
+}
@@ -0,0 +1,248 @@
+// This file is part of utm.
+
+// (c) Copyright 2019 Miguel Aguiar.
+//
+// This program is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option) any
+// later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU Lesser General Public License for more details.
+
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#define _XOPEN_SOURCE 700
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+
+#include "shadow.h"
+#include "utm/shadow.h"
+#include "utm/utm.h"
+
+// Capacity of the sample queue
+#define QUEUE_CAP 4096
+
+// Samples moved in and out of the queue at once
+#define SAMPLE_BATCH 64
+
+struct sample {
+	double lat, lon;
+	double x, y; /* Result of the batch routine */
+	int zone;    /* Zone passed to the batch routine, or 0 */
+};
+
+/* Sampling rate, zero while stopped.  Read without a lock by the batch
+   routines. */
+static unsigned long shadow_rate;
+
+/* Seeds of the sample positions of successive calls */
+static uint64_t shadow_seq;
+
+static pthread_mutex_t control = PTHREAD_MUTEX_INITIALIZER; /* Start, stop */
+static pthread_t thread;
+static int running;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER; /* All below */
+static pthread_cond_t queue_cv = PTHREAD_COND_INITIALIZER;
+static int stopping;
+static struct sample queue[QUEUE_CAP];
+static size_t head, tail;
+
+static unsigned long long samples, dropped;
+static double max_error, sum_sq, max_lat, max_lon;
+
+static uint64_t splitmix64(uint64_t *state)
+{
+	uint64_t z = (*state += 0x9E3779B97F4A7C15ull);
+
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+	return z ^ (z >> 31);
+}
+
+// Number of points to skip before the next sample: geometrically distributed,
+// so that every point is sampled with the same probability regardless of
+// the size of the calls.  logq is log(1 - 1 / rate).
+static size_t next_gap(uint64_t *state, double logq)
+{
+	if (isinf(logq))
+		return 0;
+
+	double const u = (double)((splitmix64(state) >> 11) + 1) * 0x1p-53;
+	double const gap = floor(log(u) / logq);
+
+	return gap < (double)(SIZE_MAX / 2) ? (size_t)gap : SIZE_MAX / 2;
+}
+
+static void enqueue(struct sample const *s, size_t n)
+{
+	pthread_mutex_lock(&lock);
+	for (size_t i = 0; i < n; ++i) {
+		if (tail - head < QUEUE_CAP)
+			queue[tail++ % QUEUE_CAP] = s[i];
+		else
+			++dropped;
+	}
+	pthread_cond_signal(&queue_cv);
+	pthread_mutex_unlock(&lock);
+}
+
+void utm_shadow_sample_forward(size_t n,
+			       double const *lat,
+			       double const *lon,
+			       int const *zone,
+			       double const *x,
+			       double const *y)
+{
+	unsigned long const rate =
+	    __atomic_load_n(&shadow_rate, __ATOMIC_RELAXED);
+
+	if (!rate || !n)
+		return;
+
+	uint64_t state = __atomic_fetch_add(
+	    &shadow_seq, 0x2545F4914F6CDD1Dull, __ATOMIC_RELAXED);
+	double const logq = log1p(-1.0 / (double)rate);
+	struct sample buf[SAMPLE_BATCH];
+	size_t k = 0;
+
+	for (size_t i = next_gap(&state, logq); i < n;
+	     i += 1 + next_gap(&state, logq)) {
+		if (isnan(x[i]))
+			continue;
+
+		buf[k++] = (struct sample){
+		    lat[i], lon[i], x[i], y[i], zone ? *zone : 0};
+
+		if (k == SAMPLE_BATCH) {
+			enqueue(buf, k);
+			k = 0;
+		}
+	}
+
+	if (k)
+		enqueue(buf, k);
+}
+
+static double discrepancy(struct sample const *s)
+{
+	double x, y;
+
+	if (utm_lat_lon_to_utm_series(
+		s->lat, s->lon, s->zone ? &s->zone : NULL, &x, &y) < 0)
+		return NAN;
+
+	/* Points within rounding of the equator may get the false northing
+	   in one routine and not in the other. */
+	double dy = y - s->y;
+	if (fabs(dy) > 5000000.0)
+		dy -= copysign(10000000.0, dy);
+
+	return hypot(x - s->x, dy);
+}
+
+static void *shadow_main(void *arg)
+{
+	struct sample batch[SAMPLE_BATCH];
+	double err[SAMPLE_BATCH];
+
+	(void)arg;
+
+	pthread_mutex_lock(&lock);
+	for (;;) {
+		while (head == tail && !stopping)
+			pthread_cond_wait(&queue_cv, &lock);
+		if (head == tail)
+			break;
+
+		size_t k = 0;
+		while (head != tail && k < SAMPLE_BATCH)
+			batch[k++] = queue[head++ % QUEUE_CAP];
+		pthread_mutex_unlock(&lock);
+
+		for (size_t i = 0; i < k; ++i)
+			err[i] = discrepancy(&batch[i]);
+
+		pthread_mutex_lock(&lock);
+		for (size_t i = 0; i < k; ++i) {
+			if (isnan(err[i]))
+				continue;
+
+			++samples;
+			sum_sq += err[i] * err[i];
+			if (err[i] > max_error || samples == 1) {
+				max_error = err[i];
+				max_lat = batch[i].lat;
+				max_lon = batch[i].lon;
+			}
+		}
+	}
+	pthread_mutex_unlock(&lock);
+
+	return NULL;
+}
+
+int utm_shadow_start(unsigned long rate)
+{
+	if (!rate)
+		return -1;
+
+	pthread_mutex_lock(&control);
+	if (!running) {
+		stopping = 0;
+		if (pthread_create(&thread, NULL, shadow_main, NULL)) {
+			pthread_mutex_unlock(&control);
+			return -1;
+		}
+		running = 1;
+	}
+	__atomic_store_n(&shadow_rate, rate, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&control);
+
+	return 0;
+}
+
+void utm_shadow_stop(void)
+{
+	pthread_mutex_lock(&control);
+	if (running) {
+		__atomic_store_n(&shadow_rate, 0, __ATOMIC_RELAXED);
+
+		pthread_mutex_lock(&lock);
+		stopping = 1;
+		pthread_cond_signal(&queue_cv);
+		pthread_mutex_unlock(&lock);
+
+		pthread_join(thread, NULL);
+		running = 0;
+	}
+	pthread_mutex_unlock(&control);
+}
+
+void utm_shadow_snapshot(struct utm_shadow_stats *stats)
+{
+	if (!stats)
+		return;
+
+	pthread_mutex_lock(&lock);
+	stats->samples = samples;
+	stats->dropped = dropped;
+	stats->max_error = max_error;
+	stats->rms_error = samples ? sqrt(sum_sq / (double)samples) : 0.0;
+	stats->max_lat = max_lat;
+	stats->max_lon = max_lon;
+	pthread_mutex_unlock(&lock);
+}
+
+void utm_shadow_reset(void)
+{
+	pthread_mutex_lock(&lock);
+	samples = dropped = 0;
+	max_error = sum_sq = max_lat = max_lon = 0.0;
+	pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,40 @@
+// This file is part of utm.
+
+// (c) Copyright 2019 Miguel Aguiar.
+//
+// This program is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option) any
+// later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU Lesser General Public License for more details.
+
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+// Internal interface between the batch routines and shadow sampling.
+
+#ifndef UTM_SHADOW_INTERNAL_HEADER_GUARD_
+#define UTM_SHADOW_INTERNAL_HEADER_GUARD_
+
+#include <stddef.h>
+
+// Queues a random sample of the points of a forward batch conversion for
+// re-evaluation, if shadow sampling is running.  zone is as passed to the
+// batch routine.
+void utm_shadow_sample_forward(size_t n,
+			       double const *lat,
+			       double const *lon,
+			       int const *zone,
+			       double const *x,
+			       double const *y);
+
+// Same as lat_lon_to_utm, but always summing the series: the reference of the
+// shadow sampling, which must not share the tables of the batch routines.
+int utm_lat_lon_to_utm_series(
+    double lat, double lon, int const *zone, double *x, double *y);
+
+#endif
@@ -0,0 +1,210 @@
+// This file is part of utm.
+
+// (c) Copyright 2019 Miguel Aguiar.
+//
+// This program is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option) any
+// later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU Lesser General Public License for more details.
+
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+// Tests of the SQLite extension, loaded through the sqlite3 C API.  Run from
+// the top directory, where the extension is built.
+
+#include <math.h>
+#include <sqlite3.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "greatest.h"
+#include "utm/utm.h"
+
+#define EXTENSION "./utm_sqlite.so"
+
+// Rows of the table pts, more than two blocks of the extension
+#define ROWS 2500
+
+static sqlite3 *db;
+
+// Runs sql, which must succeed.
+static int exec(char const *sql)
+{
+	char *err = NULL;
+	int const rc = sqlite3_exec(db, sql, NULL, NULL, &err);
+
+	if (rc != SQLITE_OK)
+		fprintf(stderr, "%s: %s\n", sql, err);
+	sqlite3_free(err);
+
+	return rc;
+}
+
+// Latitude and longitude of row id of pts, in zones 30 to 32.
+static double row_lat(int id) { return -60.0 + 120.0 * id / ROWS; }
+static double row_lon(int id) { return -5.0 + 16.0 * ((id * 7) % ROWS) / ROWS; }
+
+TEST load(void)
+{
+	char *err = NULL;
+
+	ASSERT_EQ(sqlite3_enable_load_extension(db, 1), SQLITE_OK);
+	if (sqlite3_load_extension(db, EXTENSION, NULL, &err) != SQLITE_OK) {
+		fprintf(stderr, "%s: %s\n", EXTENSION, err);
+		sqlite3_free(err);
+		FAIL();
+	}
+
+	/* Row id 0 has NULL coordinates. */
+	ASSERT_EQ(exec("CREATE TABLE pts (id INTEGER PRIMARY KEY, lat, lon)"),
+		  SQLITE_OK);
+	ASSERT_EQ(exec("INSERT INTO pts VALUES (0, NULL, 3.0)"), SQLITE_OK);
+
+	sqlite3_stmt *st;
+	ASSERT_EQ(sqlite3_prepare_v2(db, "INSERT INTO pts VALUES (?, ?, ?)", -1,
+				     &st, NULL),
+		  SQLITE_OK);
+	exec("BEGIN");
+	for (int id = 1; id < ROWS; ++id) {
+		sqlite3_bind_int(st, 1, id);
+		sqlite3_bind_double(st, 2, row_lat(id));
+		sqlite3_bind_double(st, 3, row_lon(id));
+		ASSERT_EQ(sqlite3_step(st), SQLITE_DONE);
+		sqlite3_reset(st);
+	}
+	exec("COMMIT");
+	sqlite3_finalize(st);
+
+	PASS();
+}
+
+// Checks every row of utm_project over pts, with the given zone or none.
+static enum greatest_test_res check_project(int zone)
+{
+	char sql[160];
+	sqlite3_stmt *st;
+	int id = 0;
+
+	snprintf(sql, sizeof sql,
+		 "SELECT id, lat, easting, northing, zone FROM utm_project("
+		 "'SELECT id, lat, lon FROM pts ORDER BY id'%s)",
+		 zone ? ", 31" : "");
+	ASSERT_EQ(sqlite3_prepare_v2(db, sql, -1, &st, NULL), SQLITE_OK);
+
+	for (; sqlite3_step(st) == SQLITE_ROW; ++id) {
+		ASSERT_EQ(sqlite3_column_int(st, 0), id);
+
+		if (id == 0) {
+			for (int col = 1; col < 5; ++col)
+				ASSERT_EQ(sqlite3_column_type(st, col),
+					  SQLITE_NULL);
+			continue;
+		}
+
+		double const lat = row_lat(id), lon = row_lon(id);
+		double x, y;
+		int z;
+
+		/* The rows are converted with the batch routine. */
+		lat_lon_to_utm_batch(1, &lat, &lon, zone ? &zone : NULL, &x, &y,
+				     &z);
+		ASSERT_EQ(sqlite3_column_int(st, 4), z);
+		ASSERT_EQ(sqlite3_column_double(st, 2), x);
+		ASSERT_EQ(sqlite3_column_double(st, 3), y);
+	}
+
+	sqlite3_finalize(st);
+	ASSERT_EQ(id, ROWS);
+	PASS();
+}
+
+TEST project(void) { CHECK_CALL(check_project(0)); PASS(); }
+
+TEST project_zone(void) { CHECK_CALL(check_project(31)); PASS(); }
+
+TEST scalar_functions(void)
+{
+	sqlite3_stmt *st;
+	double x, y;
+	int const zone = 31;
+
+	lat_lon_to_utm(45.0, 8.0, &zone, &x, &y);
+
+	ASSERT_EQ(sqlite3_prepare_v2(db,
+				     "SELECT utm_easting(45.0, 8.0, 31), "
+				     "utm_northing(45.0, 8.0, 31), "
+				     "utm_zone(8.0), utm_easting(NULL, 8.0)",
+				     -1, &st, NULL),
+		  SQLITE_OK);
+	ASSERT_EQ(sqlite3_step(st), SQLITE_ROW);
+	ASSERT_EQ(sqlite3_column_double(st, 0), x);
+	ASSERT_EQ(sqlite3_column_double(st, 1), y);
+	ASSERT_EQ(sqlite3_column_int(st, 2), 32);
+	ASSERT_EQ(sqlite3_column_type(st, 3), SQLITE_NULL);
+	sqlite3_finalize(st);
+
+	PASS();
+}
+
+// Returns the error of running sql, or null if it succeeds.
+static char const *error_of(char const *sql)
+{
+	static char msg[256];
+	char *err = NULL;
+
+	if (sqlite3_exec(db, sql, NULL, NULL, &err) == SQLITE_OK)
+		return NULL;
+
+	snprintf(msg, sizeof msg, "%s", err ? err : "");
+	sqlite3_free(err);
+
+	return msg;
+}
+
+TEST errors(void)
+{
+	char const *e;
+
+	ASSERT((e = error_of("SELECT utm_easting(45.0, 8.0, 61)")));
+	ASSERT(strstr(e, "invalid zone"));
+	ASSERT((e = error_of("SELECT * FROM utm_project('SELECT 1')")));
+	ASSERT(strstr(e, "(id, lat, lon)"));
+	ASSERT((e = error_of("SELECT * FROM utm_project("
+			     "'SELECT id, lat, lon FROM pts', 0)")));
+	ASSERT(strstr(e, "invalid zone"));
+	ASSERT((e = error_of("SELECT * FROM utm_project(42)")));
+	ASSERT(strstr(e, "missing sql argument"));
+	ASSERT(error_of("SELECT * FROM utm_project()"));
+	ASSERT(error_of("SELECT utm_easting(45.0)"));
+
+	PASS();
+}
+
+SUITE(test_sqlite)
+{
+	/* The tests share the database filled by the first one. */
+	sqlite3_open(":memory:", &db);
+	RUN_TEST(load);
+	RUN_TEST(project);
+	RUN_TEST(project_zone);
+	RUN_TEST(scalar_functions);
+	RUN_TEST(errors);
+	sqlite3_close(db);
+}
+
+GREATEST_MAIN_DEFS();
+
+int main(int argc, char **argv)
+{
+	GREATEST_MAIN_BEGIN();
+
+	RUN_SUITE(test_sqlite);
+
+	GREATEST_MAIN_END();
+}
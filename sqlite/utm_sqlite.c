@@ -0,0 +1,499 @@
+// This file is part of utm.
+
+// (c) Copyright 2019 Miguel Aguiar.
+//
+// This program is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option) any
+// later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU Lesser General Public License for more details.
+
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+// SQLite loadable extension exposing the utm conversions.
+//
+// Scalar functions:
+// 	utm_zone(lon)
+// 	utm_easting(lat, lon [, zone])
+// 	utm_northing(lat, lon [, zone])
+// 	utm_lat(easting, northing, zone, southhemi)
+// 	utm_lon(easting, northing, zone, southhemi)
+//
+// Table-valued function:
+// 	utm_project(sql [, zone])
+//
+// 	Runs sql, which must return the columns (id, lat, lon), and yields the
+// 	columns (id, lat, lon, easting, northing, zone).  Rows are pulled from
+// 	the inner statement in blocks of UTM_SQLITE_BLOCK and converted with
+// 	lat_lon_to_utm_batch, so
+//
+// 		INSERT INTO pts_utm
+// 		SELECT id, easting, northing, zone
+// 		FROM utm_project('SELECT id, lat, lon FROM pts');
+//
+// 	runs at batch throughput instead of paying for one function call per
+// 	output column and row.  Rows whose coordinates cannot be converted
+// 	have NULL easting, northing and zone.
+
+#include <sqlite3ext.h>
+SQLITE_EXTENSION_INIT1
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "utm/utm.h"
+
+#ifndef UTM_SQLITE_BLOCK
+#define UTM_SQLITE_BLOCK 1024
+#endif
+
+static void utm_zone_func(sqlite3_context *ctx, int argc, sqlite3_value **argv)
+{
+	(void)argc;
+
+	if (sqlite3_value_type(argv[0]) == SQLITE_NULL)
+		return;
+
+	double const lon = sqlite3_value_double(argv[0]);
+	double const lat = 0.0;
+	double x, y;
+	int const zone = lat_lon_to_utm(lat, lon, NULL, &x, &y);
+
+	if (zone > 0)
+		sqlite3_result_int(ctx, zone);
+}
+
+// Shared implementation of utm_easting and utm_northing; the user data
+// selects the output.
+static void utm_forward_func(sqlite3_context *ctx,
+			     int argc,
+			     sqlite3_value **argv)
+{
+	for (int i = 0; i < argc; ++i)
+		if (sqlite3_value_type(argv[i]) == SQLITE_NULL)
+			return;
+
+	int zone;
+	int const *pzone = NULL;
+
+	if (argc > 2) {
+		zone = sqlite3_value_int(argv[2]);
+		pzone = &zone;
+	}
+
+	double x, y;
+	if (lat_lon_to_utm(sqlite3_value_double(argv[0]),
+			   sqlite3_value_double(argv[1]),
+			   pzone,
+			   &x,
+			   &y) < 0) {
+		sqlite3_result_error(ctx, "utm: invalid zone", -1);
+		return;
+	}
+
+	sqlite3_result_double(ctx, sqlite3_user_data(ctx) ? y : x);
+}
+
+// Shared implementation of utm_lat and utm_lon; the user data selects the
+// output.
+static void utm_inverse_func(sqlite3_context *ctx,
+			     int argc,
+			     sqlite3_value **argv)
+{
+	for (int i = 0; i < argc; ++i)
+		if (sqlite3_value_type(argv[i]) == SQLITE_NULL)
+			return;
+
+	int const zone = sqlite3_value_int(argv[2]);
+	if (zone < 1 || zone > 60) {
+		sqlite3_result_error(ctx, "utm: invalid zone", -1);
+		return;
+	}
+
+	double lat, lon;
+	utm_to_lat_lon(sqlite3_value_double(argv[0]),
+		       sqlite3_value_double(argv[1]),
+		       zone,
+		       sqlite3_value_int(argv[3]),
+		       &lat,
+		       &lon);
+
+	sqlite3_result_double(ctx, sqlite3_user_data(ctx) ? lon : lat);
+}
+
+/* Columns of utm_project */
+enum {
+	UTM_COL_ID,
+	UTM_COL_LAT,
+	UTM_COL_LON,
+	UTM_COL_EASTING,
+	UTM_COL_NORTHING,
+	UTM_COL_ZONE,
+	UTM_COL_SQL,	 /* hidden: inner query */
+	UTM_COL_FORCEZONE /* hidden: optional fixed zone */
+};
+
+struct utm_vtab {
+	sqlite3_vtab base;
+	sqlite3 *db;
+};
+
+struct utm_cursor {
+	sqlite3_vtab_cursor base;
+	sqlite3_stmt *stmt; /* Inner query */
+	int done;	    /* Inner query exhausted */
+	int zone;	    /* Fixed zone, or 0 to pick per point */
+	size_t len;	    /* Rows in the current block */
+	size_t pos;	    /* Current row within the block */
+	sqlite3_int64 rowid;
+	sqlite3_int64 id[UTM_SQLITE_BLOCK];
+	unsigned char isnull[UTM_SQLITE_BLOCK];
+	double lat[UTM_SQLITE_BLOCK];
+	double lon[UTM_SQLITE_BLOCK];
+	double x[UTM_SQLITE_BLOCK];
+	double y[UTM_SQLITE_BLOCK];
+	int zones[UTM_SQLITE_BLOCK];
+};
+
+static int utm_connect(sqlite3 *db,
+		       void *aux,
+		       int argc,
+		       char const *const *argv,
+		       sqlite3_vtab **vtab,
+		       char **err)
+{
+	(void)aux;
+	(void)argc;
+	(void)argv;
+	(void)err;
+
+	int const rc = sqlite3_declare_vtab(
+	    db,
+	    "CREATE TABLE x(id, lat, lon, easting, northing, zone, "
+	    "sql HIDDEN, force_zone HIDDEN)");
+	if (rc != SQLITE_OK)
+		return rc;
+
+	struct utm_vtab *v = sqlite3_malloc(sizeof *v);
+	if (!v)
+		return SQLITE_NOMEM;
+
+	memset(v, 0, sizeof *v);
+	v->db = db;
+	*vtab = &v->base;
+
+	return SQLITE_OK;
+}
+
+static int utm_disconnect(sqlite3_vtab *vtab)
+{
+	sqlite3_free(vtab);
+	return SQLITE_OK;
+}
+
+static int utm_open(sqlite3_vtab *vtab, sqlite3_vtab_cursor **cursor)
+{
+	(void)vtab;
+
+	struct utm_cursor *c = sqlite3_malloc(sizeof *c);
+	if (!c)
+		return SQLITE_NOMEM;
+
+	memset(c, 0, sizeof *c);
+	*cursor = &c->base;
+
+	return SQLITE_OK;
+}
+
+static int utm_close(sqlite3_vtab_cursor *cursor)
+{
+	struct utm_cursor *c = (struct utm_cursor *)cursor;
+
+	sqlite3_finalize(c->stmt);
+	sqlite3_free(c);
+
+	return SQLITE_OK;
+}
+
+// Pulls the next block of rows from the inner query and converts it.
+static int utm_fill(struct utm_cursor *c)
+{
+	c->len = 0;
+	c->pos = 0;
+
+	while (!c->done && c->len < UTM_SQLITE_BLOCK) {
+		int const rc = sqlite3_step(c->stmt);
+
+		if (rc == SQLITE_DONE) {
+			c->done = 1;
+			break;
+		}
+
+		if (rc != SQLITE_ROW) {
+			c->base.pVtab->zErrMsg = sqlite3_mprintf(
+			    "utm_project: %s",
+			    sqlite3_errmsg(sqlite3_db_handle(c->stmt)));
+			return SQLITE_ERROR;
+		}
+
+		size_t const i = c->len++;
+		c->id[i] = sqlite3_column_int64(c->stmt, 0);
+		c->isnull[i] =
+		    sqlite3_column_type(c->stmt, 1) == SQLITE_NULL ||
+		    sqlite3_column_type(c->stmt, 2) == SQLITE_NULL;
+		c->lat[i] = sqlite3_column_double(c->stmt, 1);
+		c->lon[i] = sqlite3_column_double(c->stmt, 2);
+	}
+
+	if (c->len) {
+		int const *pzone = c->zone ? &c->zone : NULL;
+		lat_lon_to_utm_batch(
+		    c->len, c->lat, c->lon, pzone, c->x, c->y, c->zones);
+	}
+
+	return SQLITE_OK;
+}
+
+static int utm_filter(sqlite3_vtab_cursor *cursor,
+		      int idxnum,
+		      char const *idxstr,
+		      int argc,
+		      sqlite3_value **argv)
+{
+	(void)idxstr;
+
+	struct utm_cursor *c = (struct utm_cursor *)cursor;
+	struct utm_vtab *v = (struct utm_vtab *)cursor->pVtab;
+
+	sqlite3_finalize(c->stmt);
+	c->stmt = NULL;
+	c->done = 0;
+	c->zone = 0;
+	c->rowid = 0;
+
+	if (argc < 1 || sqlite3_value_type(argv[0]) != SQLITE_TEXT) {
+		v->base.zErrMsg =
+		    sqlite3_mprintf("utm_project: missing sql argument");
+		return SQLITE_ERROR;
+	}
+
+	if (idxnum & 2) {
+		c->zone = sqlite3_value_int(argv[1]);
+		if (c->zone < 1 || c->zone > 60) {
+			v->base.zErrMsg =
+			    sqlite3_mprintf("utm_project: invalid zone");
+			return SQLITE_ERROR;
+		}
+	}
+
+	char const *sql = (char const *)sqlite3_value_text(argv[0]);
+	if (sqlite3_prepare_v2(v->db, sql, -1, &c->stmt, NULL) != SQLITE_OK) {
+		v->base.zErrMsg = sqlite3_mprintf("utm_project: %s",
+						  sqlite3_errmsg(v->db));
+		return SQLITE_ERROR;
+	}
+
+	if (sqlite3_column_count(c->stmt) < 3) {
+		v->base.zErrMsg = sqlite3_mprintf(
+		    "utm_project: query must return (id, lat, lon)");
+		return SQLITE_ERROR;
+	}
+
+	return utm_fill(c);
+}
+
+static int utm_next(sqlite3_vtab_cursor *cursor)
+{
+	struct utm_cursor *c = (struct utm_cursor *)cursor;
+
+	++c->rowid;
+	if (++c->pos < c->len)
+		return SQLITE_OK;
+
+	return utm_fill(c);
+}
+
+static int utm_eof(sqlite3_vtab_cursor *cursor)
+{
+	struct utm_cursor const *c = (struct utm_cursor const *)cursor;
+
+	return c->pos >= c->len;
+}
+
+static int utm_column(sqlite3_vtab_cursor *cursor,
+		      sqlite3_context *ctx,
+		      int col)
+{
+	struct utm_cursor const *c = (struct utm_cursor const *)cursor;
+	size_t const i = c->pos;
+	int const valid = !c->isnull[i] && c->zones[i] > 0;
+
+	switch (col) {
+	case UTM_COL_ID:
+		sqlite3_result_int64(ctx, c->id[i]);
+		break;
+	case UTM_COL_LAT:
+		if (!c->isnull[i])
+			sqlite3_result_double(ctx, c->lat[i]);
+		break;
+	case UTM_COL_LON:
+		if (!c->isnull[i])
+			sqlite3_result_double(ctx, c->lon[i]);
+		break;
+	case UTM_COL_EASTING:
+		if (valid)
+			sqlite3_result_double(ctx, c->x[i]);
+		break;
+	case UTM_COL_NORTHING:
+		if (valid)
+			sqlite3_result_double(ctx, c->y[i]);
+		break;
+	case UTM_COL_ZONE:
+		if (valid)
+			sqlite3_result_int(ctx, c->zones[i]);
+		break;
+	case UTM_COL_SQL:
+		sqlite3_result_text(ctx, sqlite3_sql(c->stmt), -1, NULL);
+		break;
+	case UTM_COL_FORCEZONE:
+		if (c->zone)
+			sqlite3_result_int(ctx, c->zone);
+		break;
+	}
+
+	return SQLITE_OK;
+}
+
+static int utm_rowid(sqlite3_vtab_cursor *cursor, sqlite3_int64 *rowid)
+{
+	*rowid = ((struct utm_cursor const *)cursor)->rowid;
+	return SQLITE_OK;
+}
+
+// The sql argument is required; the zone argument is optional.  idxNum has
+// bit 0 set if sql is given and bit 1 set if zone is given, and the
+// arguments are passed to xFilter in that order.
+static int utm_best_index(sqlite3_vtab *vtab, sqlite3_index_info *info)
+{
+	(void)vtab;
+
+	int sql = -1, zone = -1;
+
+	for (int i = 0; i < info->nConstraint; ++i) {
+		struct sqlite3_index_constraint const *con =
+		    &info->aConstraint[i];
+
+		if (con->op != SQLITE_INDEX_CONSTRAINT_EQ)
+			continue;
+
+		if (con->iColumn == UTM_COL_SQL) {
+			if (!con->usable)
+				return SQLITE_CONSTRAINT;
+			sql = i;
+		} else if (con->iColumn == UTM_COL_FORCEZONE) {
+			if (!con->usable)
+				return SQLITE_CONSTRAINT;
+			zone = i;
+		}
+	}
+
+	if (sql < 0) {
+		vtab->zErrMsg = sqlite3_mprintf(
+		    "utm_project: the first argument must be a query");
+		return SQLITE_ERROR;
+	}
+
+	info->aConstraintUsage[sql].argvIndex = 1;
+	info->aConstraintUsage[sql].omit = 1;
+	info->idxNum = 1;
+
+	if (zone >= 0) {
+		info->aConstraintUsage[zone].argvIndex = 2;
+		info->aConstraintUsage[zone].omit = 1;
+		info->idxNum |= 2;
+	}
+
+	info->estimatedCost = 1e6;
+
+	return SQLITE_OK;
+}
+
+static sqlite3_module const utm_project_module = {
+    0,		    /* iVersion */
+    NULL,	    /* xCreate: eponymous-only */
+    utm_connect,    /* xConnect */
+    utm_best_index, /* xBestIndex */
+    utm_disconnect, /* xDisconnect */
+    NULL,	    /* xDestroy */
+    utm_open,	    /* xOpen */
+    utm_close,	    /* xClose */
+    utm_filter,	    /* xFilter */
+    utm_next,	    /* xNext */
+    utm_eof,	    /* xEof */
+    utm_column,	    /* xColumn */
+    utm_rowid,	    /* xRowid */
+    NULL,	    /* xUpdate */
+    NULL,	    /* xBegin */
+    NULL,	    /* xSync */
+    NULL,	    /* xCommit */
+    NULL,	    /* xRollback */
+    NULL,	    /* xFindFunction */
+    NULL,	    /* xRename */
+    NULL,	    /* xSavepoint */
+    NULL,	    /* xRelease */
+    NULL,	    /* xRollbackTo */
+    NULL	    /* xShadowName */
+};
+
+#ifdef _WIN32
+__declspec(dllexport)
+#endif
+int sqlite3_utmsqlite_init(sqlite3 *db,
+			   char **err,
+			   sqlite3_api_routines const *api)
+{
+	(void)err;
+
+	SQLITE_EXTENSION_INIT2(api);
+
+	int const flags = SQLITE_UTF8 | SQLITE_DETERMINISTIC;
+	static int const second = 1;
+	int rc = SQLITE_OK;
+
+	struct {
+		char const *name;
+		int nargs;
+		void *data;
+		void (*func)(sqlite3_context *, int, sqlite3_value **);
+	} const funcs[] = {
+	    {"utm_zone", 1, NULL, utm_zone_func},
+	    {"utm_easting", 2, NULL, utm_forward_func},
+	    {"utm_easting", 3, NULL, utm_forward_func},
+	    {"utm_northing", 2, (void *)&second, utm_forward_func},
+	    {"utm_northing", 3, (void *)&second, utm_forward_func},
+	    {"utm_lat", 4, NULL, utm_inverse_func},
+	    {"utm_lon", 4, (void *)&second, utm_inverse_func},
+	};
+
+	for (size_t i = 0; rc == SQLITE_OK && i < sizeof funcs / sizeof *funcs;
+	     ++i)
+		rc = sqlite3_create_function(db,
+					     funcs[i].name,
+					     funcs[i].nargs,
+					     flags,
+					     funcs[i].data,
+					     funcs[i].func,
+					     NULL,
+					     NULL);
+
+	if (rc == SQLITE_OK)
+		rc = sqlite3_create_module(
+		    db, "utm_project", &utm_project_module, NULL);
+
+	return rc;
+}
@@ -15,8 +15,23 @@
 // You should have received a copy of the GNU Lesser General Public License
 // along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
+#define _XOPEN_SOURCE 700
+
+#include "utm/buffer.h"
+#include "utm/geometry.h"
+#include "utm/graticule.h"
+#include "utm/pipeline.h"
+#include "utm/runner.h"
+#include "utm/sched.h"
+#include "utm/shadow.h"
+#include "utm/track.h"
+#include "utm/tune.h"
 #include "utm/utm.h"
+#include "utm/velocity.h"
+#include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "greatest.h"
 
@@ -224,14 +239,1582 @@ SUITE(test_lat_lon_to_utm)
 	RUN_TEST(test_lat_lon_to_utm_invalid);
 }
 
+TEST test_lat_lon_to_utm_batch_matches_scalar(void)
+{
+	enum { npts = 181 * 13 };
+	static double lat[npts], lon[npts], x[npts], y[npts];
+	static int zones[npts];
+
+	for (int i = 0; i < npts; ++i) {
+		lat[i] = -84.0 + 168.0 * (i / 13) / 180.0;
+		lon[i] = -179.5 + 27.7 * (i % 13);
+	}
+
+	ASSERT_EQ(lat_lon_to_utm_batch(npts, lat, lon, NULL, x, y, zones), 0);
+
+	for (int i = 0; i < npts; ++i) {
+		double easting, northing;
+		int const zone =
+		    lat_lon_to_utm(lat[i], lon[i], NULL, &easting, &northing);
+
+		ASSERT_EQ(zone, zones[i]);
+		ASSERT_IN_RANGE(easting, x[i], 1e-6);
+		ASSERT_IN_RANGE(northing, y[i], 1e-6);
+	}
+
+	PASS();
+}
+
+TEST test_utm_to_lat_lon_batch_matches_scalar(void)
+{
+	enum { npts = 200 };
+	double x[npts], y[npts], lat[npts], lon[npts];
+
+	for (int i = 0; i < npts; ++i) {
+		x[i] = 170000.0 + 3300.0 * i;
+		y[i] = 1100000.0 + 44500.0 * i;
+	}
+
+	ASSERT_EQ(utm_to_lat_lon_batch(npts, x, y, 33, 1, lat, lon), 0);
+
+	for (int i = 0; i < npts; ++i) {
+		double plat, plon;
+
+		ASSERT_EQ(utm_to_lat_lon(x[i], y[i], 33, 1, &plat, &plon), 0);
+		ASSERT_IN_RANGE(plat, lat[i], 1e-11);
+		ASSERT_IN_RANGE(plon, lon[i], 1e-11);
+	}
+
+	PASS();
+}
+
+TEST test_lat_lon_to_utm_batch_dd(void)
+{
+	enum { npts = 91 * 13 };
+	static double lat[npts], lon[npts], x[npts], y[npts], xd[npts],
+	    yd[npts];
+	static int zones[npts], zonesd[npts];
+
+	for (int i = 0; i < npts; ++i) {
+		lat[i] = -84.0 + 168.0 * (i / 13) / 90.0;
+		lon[i] = -179.5 + 27.7 * (i % 13);
+	}
+
+	ASSERT_EQ(lat_lon_to_utm_batch(npts, lat, lon, NULL, x, y, zones), 0);
+	ASSERT_EQ(
+	    lat_lon_to_utm_batch_dd(npts, lat, lon, NULL, xd, yd, zonesd), 0);
+
+	for (int i = 0; i < npts; ++i) {
+		ASSERT_EQ(zones[i], zonesd[i]);
+		ASSERT_IN_RANGE(x[i], xd[i], 1e-8);
+		ASSERT_IN_RANGE(y[i], yd[i], 1e-8);
+	}
+
+	ASSERT_EQ(lat_lon_to_utm_batch_dd(1, lat, lon, NULL, NULL, y, NULL),
+		  -1);
+
+	PASS();
+}
+
+TEST test_lat_lon_to_utm_batch_ext(void)
+{
+	double const lat[] = {40.0, 40.0, -35.0, 10.0};
+	double const lon[] = {4.0, 12.5, -7.0, 29.0};
+	int const zone = 31;
+	double x[4], y[4], bx[4], by[4], plat[4], plon[4];
+	int zones[4];
+	unsigned char flags[4], iflags[4];
+
+	ASSERT_EQ(lat_lon_to_utm_batch_ext(4,
+					   lat,
+					   lon,
+					   &zone,
+					   UTM_EXT_SWITCH_DEG,
+					   UTM_EXT_LIMIT_DEG,
+					   x,
+					   y,
+					   zones,
+					   flags,
+					   NULL),
+		  0);
+	ASSERT_EQ(lat_lon_to_utm_batch(4, lat, lon, &zone, bx, by, NULL), 0);
+
+	/* Within the switch threshold the fast path is used unchanged. */
+	ASSERT_EQ(flags[0], 0);
+	ASSERT_EQ(x[0], bx[0]);
+	ASSERT_EQ(y[0], by[0]);
+
+	ASSERT_EQ(flags[1], UTM_EXT_WIDE);
+	ASSERT_EQ(flags[2], UTM_EXT_WIDE);
+	ASSERT_EQ(flags[3], UTM_EXT_WIDE | UTM_EXT_BEYOND_LIMIT);
+	ASSERT_EQ(zones[3], 31);
+
+	/* A limit below the switch still flags the points past it. */
+	ASSERT_EQ(lat_lon_to_utm_batch_ext(
+		      2, lat, lon, &zone, 10.0, 0.5, x, y, NULL, flags, NULL),
+		  0);
+	ASSERT_EQ(flags[0], UTM_EXT_BEYOND_LIMIT);
+	ASSERT_EQ(flags[1], UTM_EXT_BEYOND_LIMIT);
+	ASSERT_EQ(lat_lon_to_utm_batch_ext(4,
+					   lat,
+					   lon,
+					   &zone,
+					   UTM_EXT_SWITCH_DEG,
+					   UTM_EXT_LIMIT_DEG,
+					   x,
+					   y,
+					   zones,
+					   flags,
+					   NULL),
+		  0);
+
+	/* 9.5 degrees out the fast series is off by centimeters. */
+	ASSERT(fabs(x[1] - bx[1]) > 1e-3 || fabs(y[1] - by[1]) > 1e-3);
+
+	ASSERT_EQ(utm_to_lat_lon_batch_ext(2,
+					   &x[1],
+					   &y[1],
+					   31,
+					   0,
+					   UTM_EXT_SWITCH_DEG,
+					   plat,
+					   plon,
+					   iflags),
+		  0);
+	ASSERT_EQ(iflags[0], UTM_EXT_WIDE);
+	ASSERT_IN_RANGE(lat[1], plat[0], 1e-9);
+	ASSERT_IN_RANGE(lon[1], plon[0], 1e-9);
+
+	ASSERT_EQ(utm_to_lat_lon_batch_ext(1,
+					   &x[2],
+					   &y[2],
+					   31,
+					   1,
+					   UTM_EXT_SWITCH_DEG,
+					   plat,
+					   plon,
+					   NULL),
+		  0);
+	ASSERT_IN_RANGE(lat[2], plat[0], 1e-9);
+	ASSERT_IN_RANGE(lon[2], plon[0], 1e-9);
+
+	ASSERT_EQ(lat_lon_to_utm_batch_ext(
+		      1, lat, lon, &zone, -1.0, 20.0, x, y, NULL, NULL, NULL),
+		  -1);
+
+	PASS();
+}
+
+TEST test_lat_lon_to_utm_batch_ext_err(void)
+{
+	double const lat[] = {0.0, 0.0, 47.0, 47.0};
+	double const lon[] = {3.1, 8.0, 3.1, 8.0};
+	int const zone = 31;
+	double fx[4], fy[4], wx[4], wy[4], ferr[4], werr[4];
+
+	/* Fast series everywhere, then the wide-validity engine everywhere */
+	ASSERT_EQ(lat_lon_to_utm_batch_ext(
+		      4, lat, lon, &zone, 6.0, 90.0, fx, fy, NULL, NULL, ferr),
+		  0);
+	ASSERT_EQ(lat_lon_to_utm_batch_ext(
+		      4, lat, lon, &zone, 0.0, 90.0, wx, wy, NULL, NULL, werr),
+		  0);
+
+	for (int i = 0; i < 4; ++i) {
+		double const d = hypot(fx[i] - wx[i], fy[i] - wy[i]);
+
+		ASSERT(ferr[i] >= d);
+		ASSERT(werr[i] < 1e-6);
+	}
+
+	/* Near the central meridian the bound is the floor */
+	ASSERT(ferr[0] < 1e-6);
+	ASSERT(ferr[1] > 1e-4);
+
+	PASS();
+}
+
+TEST test_lat_lon_to_utm_multi(void)
+{
+	int const zones[] = {30, 31, 32};
+	double x[3], y[3];
+
+	ASSERT_EQ(lat_lon_to_utm_multi(-41.5, 5.9, zones, 3, x, y), 0);
+
+	for (int j = 0; j < 3; ++j) {
+		double easting, northing;
+
+		lat_lon_to_utm(-41.5, 5.9, &zones[j], &easting, &northing);
+		ASSERT_IN_RANGE(easting, x[j], 1e-6);
+		ASSERT_IN_RANGE(northing, y[j], 1e-6);
+	}
+
+	int const bad[] = {31, 0};
+	ASSERT_EQ(lat_lon_to_utm_multi(-41.5, 5.9, bad, 2, x, y), -1);
+
+	PASS();
+}
+
+TEST test_lat_lon_to_utm_batch_seam(void)
+{
+	double const lat[] = {52.0, 52.0, 52.0, -10.0};
+	double const lon[] = {5.9, 6.05, 3.0, 179.9};
+	double x[4], y[4], x2[4], y2[4];
+	int zones[4], zones2[4];
+
+	ASSERT_EQ(lat_lon_to_utm_batch_seam(
+		      4, lat, lon, 0.2, x, y, zones, x2, y2, zones2),
+		  0);
+
+	ASSERT_EQ(zones[0], 31);
+	ASSERT_EQ(zones2[0], 32);
+	ASSERT_EQ(zones[1], 32);
+	ASSERT_EQ(zones2[1], 31);
+	ASSERT_EQ(zones2[2], -1);
+	ASSERT(isnan(x2[2]) && isnan(y2[2]));
+	ASSERT_EQ(zones[3], 60);
+	ASSERT_EQ(zones2[3], 1);
+
+	for (int i = 0; i < 4; ++i) {
+		double easting, northing;
+
+		if (zones2[i] < 0)
+			continue;
+
+		/* Across the antimeridian, zone 1 is to the east of 180. */
+		double const lon_ = zones2[i] == 1 ? lon[i] - 360.0 : lon[i];
+
+		lat_lon_to_utm(lat[i], lon_, &zones2[i], &easting, &northing);
+		ASSERT_IN_RANGE(easting, x2[i], 1e-6);
+		ASSERT_IN_RANGE(northing, y2[i], 1e-6);
+	}
+
+	PASS();
+}
+
+TEST test_batch_invalid(void)
+{
+	double lat[2] = {10.0, 20.0}, lon[2] = {190.0, 20.0};
+	double x[2], y[2];
+	int zones[2];
+	int zone = 61;
+
+	ASSERT_EQ(lat_lon_to_utm_batch(2, lat, lon, NULL, NULL, y, NULL), -1);
+	ASSERT_EQ(lat_lon_to_utm_batch(2, lat, lon, &zone, x, y, NULL), -1);
+	ASSERT_EQ(utm_to_lat_lon_batch(2, lat, lon, 1, 0, x, NULL), -1);
+
+	ASSERT_EQ(lat_lon_to_utm_batch(2, lat, lon, NULL, x, y, zones), 1);
+	ASSERT_EQ(zones[0], -1);
+	ASSERT(isnan(x[0]) && isnan(y[0]));
+	ASSERT_EQ(zones[1], 34);
+
+	PASS();
+}
+
+TEST test_shadow_sampling(void)
+{
+	enum { N = 500 };
+	double lat[N], lon[N], x[N], y[N];
+	struct utm_shadow_stats st;
+
+	for (int i = 0; i < N; ++i) {
+		lat[i] = -79.5 + 163.0 * i / N;
+		lon[i] = -179.5 + 359.0 * ((i * 7919) % N) / N;
+	}
+	lat[7] = NAN;
+
+	ASSERT_EQ(utm_shadow_start(0), -1);
+
+	utm_shadow_reset();
+	ASSERT_EQ(utm_shadow_start(1), 0);
+	lat_lon_to_utm_batch(N, lat, lon, NULL, x, y, NULL);
+	lat_lon_to_utm_batch_dd(N, lat, lon, NULL, x, y, NULL);
+	utm_shadow_stop();
+
+	utm_shadow_snapshot(&st);
+	ASSERT_EQ(st.samples + st.dropped, 2 * (N - 1));
+	ASSERT(st.samples > 0);
+	ASSERT(st.max_error < 1e-6);
+	ASSERT(st.rms_error <= st.max_error);
+
+	/* Nothing is sampled once stopped. */
+	utm_shadow_reset();
+	lat_lon_to_utm_batch(N, lat, lon, NULL, x, y, NULL);
+	utm_shadow_snapshot(&st);
+	ASSERT_EQ(st.samples, 0);
+
+	PASS();
+}
+
+TEST test_track_simplify(void)
+{
+	enum { N = 20000 };
+	static double lat[N], lon[N], x[N], y[N], sx[N], sy[N];
+	static size_t idx[N];
+	size_t count;
+
+	/* A winding track with a few meters of jitter, across a window. */
+	for (int i = 0; i < N; ++i) {
+		double const t = i / (double)N;
+
+		lat[i] = 40.0 + 0.5 * t + 0.01 * sin(40.0 * t) +
+			 3e-5 * sin(1000.0 * i);
+		lon[i] = -3.5 + 0.4 * t + 0.02 * cos(25.0 * t);
+	}
+	lat[100] = NAN;
+
+	ASSERT_EQ(utm_track_simplify(N, lat, lon, NULL, 10.0, sx, sy, idx,
+				     &count),
+		  30);
+	ASSERT(count > 2 && count < N / 20);
+	ASSERT_EQ(idx[0], 0);
+	ASSERT_EQ(idx[count - 1], N - 1);
+
+	/* Every point is within the tolerance of its simplified segment. */
+	int const zone = 30;
+	lat_lon_to_utm_batch(N, lat, lon, &zone, x, y, NULL);
+	for (size_t k = 0; k + 1 < count; ++k) {
+		ASSERT(idx[k] < idx[k + 1]);
+		ASSERT_EQ(sx[k], x[idx[k]]);
+
+		double const dx = sx[k + 1] - sx[k], dy = sy[k + 1] - sy[k];
+		double const len2 = dx * dx + dy * dy;
+
+		for (size_t i = idx[k] + 1; i < idx[k + 1]; ++i) {
+			if (i == 100)
+				continue;
+
+			double t = ((x[i] - sx[k]) * dx + (y[i] - sy[k]) * dy) /
+				   len2;
+			t = t < 0.0 ? 0.0 : t > 1.0 ? 1.0 : t;
+			ASSERT(hypot(sx[k] + t * dx - x[i],
+				     sy[k] + t * dy - y[i]) <= 10.0 + 1e-9);
+		}
+	}
+
+	/* Zero tolerance keeps every vertex of the jittered track. */
+	ASSERT_EQ(utm_track_simplify(50, lat, lon, &zone, 0.0, sx, sy, NULL,
+				     &count),
+		  30);
+	ASSERT_EQ(count, 50);
+
+	ASSERT_EQ(utm_track_simplify(N, lat, lon, NULL, -1.0, sx, sy, NULL,
+				     &count),
+		  -1);
+	ASSERT_EQ(utm_track_simplify(1, lat + 100, lon, NULL, 1.0, sx, sy,
+				     NULL, &count),
+		  -1);
+
+	PASS();
+}
+
+TEST test_point_buffer(void)
+{
+	enum { N = 1001 };
+	struct utm_point_buffer buf;
+	double x[N], y[N], lat[N], lon[N];
+	int zones[N];
+
+	for (int flags = 0; flags <= UTM_BUFFER_HUGE_PAGES; ++flags) {
+		ASSERT_EQ(utm_point_buffer_init(&buf, N, flags), 0);
+		ASSERT_EQ(buf.n, N);
+		ASSERT_EQ(buf.capacity % UTM_BUFFER_PAD, 0);
+		ASSERT(buf.capacity >= N);
+		ASSERT_EQ((size_t)buf.lon % UTM_BUFFER_ALIGN, 0);
+		ASSERT_EQ((size_t)buf.zone % UTM_BUFFER_ALIGN, 0);
+
+		for (int i = 0; i < N; ++i) {
+			buf.lat[i] = -79.5 + 163.0 * i / N;
+			buf.lon[i] = -179.5 + 359.0 * ((i * 7919) % N) / N;
+		}
+		buf.lat[3] = NAN;
+
+		lat_lon_to_utm_batch(N, buf.lat, buf.lon, NULL, x, y, zones);
+		ASSERT_EQ(utm_point_buffer_forward(&buf, NULL), 1);
+		for (int i = 0; i < N; ++i) {
+			ASSERT_EQ(zones[i], buf.zone[i]);
+			if (i != 3) {
+				ASSERT_EQ(x[i], buf.easting[i]);
+				ASSERT_EQ(y[i], buf.northing[i]);
+			}
+		}
+
+		utm_to_lat_lon_batch(N, x, y, 33, 1, lat, lon);
+		ASSERT_EQ(utm_point_buffer_inverse(&buf, 33, 1), 0);
+		for (int i = 0; i < N; ++i) {
+			if (i != 3) {
+				ASSERT_EQ(lat[i], buf.lat[i]);
+				ASSERT_EQ(lon[i], buf.lon[i]);
+			}
+		}
+
+		utm_point_buffer_free(&buf);
+		ASSERT_EQ(buf.lat, NULL);
+		utm_point_buffer_free(&buf);
+	}
+
+	ASSERT_EQ(utm_point_buffer_forward(NULL, NULL), -1);
+
+	PASS();
+}
+
+TEST test_batch_aosoa(void)
+{
+	enum { N = 21, B = UTM_AOSOA_BLOCK, NB = (N + B - 1) / B };
+	double lat[N], lon[N], x[N], y[N], ilat[N], ilon[N];
+	double blk[2 * B * NB], out[2 * B * NB];
+	int zones[N], bzones[N];
+
+	for (int i = 0; i < N; ++i) {
+		lat[i] = -79.5 + 163.0 * i / N;
+		lon[i] = -179.5 + 359.0 * ((i * 13) % N) / N;
+		blk[i / B * 2 * B + i % B] = lat[i];
+		blk[i / B * 2 * B + B + i % B] = lon[i];
+	}
+	lat[5] = blk[5] = NAN;
+
+	ASSERT_EQ(lat_lon_to_utm_batch(N, lat, lon, NULL, x, y, zones), 1);
+	ASSERT_EQ(lat_lon_to_utm_batch_aosoa(N, blk, NULL, out, bzones), 1);
+	for (int i = 0; i < N; ++i) {
+		if (i == 5)
+			continue;
+		ASSERT_EQ(zones[i], bzones[i]);
+		ASSERT_EQ(x[i], out[i / B * 2 * B + i % B]);
+		ASSERT_EQ(y[i], out[i / B * 2 * B + B + i % B]);
+	}
+
+	/* In place, one zone, and back. */
+	int const zone = 33;
+	lat_lon_to_utm_batch(N, lat, lon, &zone, x, y, NULL);
+	lat_lon_to_utm_batch_aosoa(N, blk, &zone, blk, NULL);
+	utm_to_lat_lon_batch(N, x, y, zone, 0, ilat, ilon);
+	ASSERT_EQ(utm_to_lat_lon_batch_aosoa(N, blk, zone, 0, blk), 0);
+	for (int i = 0; i < N; ++i) {
+		if (i == 5)
+			continue;
+		ASSERT_EQ(ilat[i], blk[i / B * 2 * B + i % B]);
+		ASSERT_EQ(ilon[i], blk[i / B * 2 * B + B + i % B]);
+	}
+
+	ASSERT_EQ(lat_lon_to_utm_batch_aosoa(N, NULL, NULL, out, NULL), -1);
+
+	PASS();
+}
+
+TEST test_split_geometry(void)
+{
+	struct utm_pieces out = {0};
+	double const lat[] = {10.0, 10.0, 11.0};
+	double const lon[] = {-4.0, 8.0, 8.5};
+
+	ASSERT_EQ(utm_split_polyline(3, lat, lon, &out), 3);
+	ASSERT_EQ(out.pieces[0].zone, 30);
+	ASSERT_EQ(out.pieces[1].zone, 31);
+	ASSERT_EQ(out.pieces[2].zone, 32);
+	ASSERT_EQ(out.pieces[0].count, 2);
+	ASSERT_EQ(out.pieces[1].count, 2);
+	ASSERT_EQ(out.pieces[2].count, 3);
+	ASSERT_EQ(out.source[0], 0);
+	ASSERT_EQ(out.source[1], UTM_SEAM_VERTEX);
+	ASSERT_EQ(out.source[6], 2);
+
+	/* The seam vertex is shared, and symmetric about the boundary. */
+	ASSERT_EQ(out.lon[1], 0.0);
+	ASSERT_EQ(out.lat[1], out.lat[2]);
+	ASSERT_EQ(out.lon[2], out.lon[1]);
+	ASSERT_IN_RANGE(1000000.0, out.easting[1] + out.easting[2], 1e-6);
+	ASSERT_EQ(out.northing[1], out.northing[2]);
+
+	double x, y;
+	int const zone = 32;
+	lat_lon_to_utm(11.0, 8.5, &zone, &x, &y);
+	ASSERT_IN_RANGE(x, out.easting[6], TEST_TOLERANCE_M);
+	ASSERT_IN_RANGE(y, out.northing[6], TEST_TOLERANCE_M);
+
+	/* Across the antimeridian */
+	double const alat[] = {-5.0, 5.0};
+	double const alon[] = {178.0, -178.0};
+	ASSERT_EQ(utm_split_polyline(2, alat, alon, &out), 2);
+	ASSERT_EQ(out.pieces[0].zone, 60);
+	ASSERT_EQ(out.pieces[1].zone, 1);
+	ASSERT_EQ(out.lon[1], 180.0);
+	ASSERT_EQ(out.lon[2], -180.0);
+	ASSERT_IN_RANGE(0.0, out.lat[1], 1e-12);
+
+	/* A closed square across a boundary gives two rectangles. */
+	double const plat[] = {10.0, 10.0, 20.0, 20.0, 10.0};
+	double const plon[] = {-1.0, 1.0, 1.0, -1.0, -1.0};
+	ASSERT_EQ(utm_split_polygon(5, plat, plon, &out), 2);
+	ASSERT_EQ(out.pieces[0].zone, 30);
+	ASSERT_EQ(out.pieces[0].count, 4);
+	ASSERT_EQ(out.pieces[1].zone, 31);
+	ASSERT_EQ(out.pieces[1].count, 4);
+	for (size_t i = 0; i < out.nvertices; ++i)
+		if (out.source[i] == UTM_SEAM_VERTEX)
+			ASSERT_EQ(out.lon[i], 0.0);
+
+	/* Projected on a scheduler, the pieces are the same. */
+	struct utm_pieces par = {0};
+	struct utm_sched *sched = utm_sched_create(2);
+	ASSERT(sched);
+	struct utm_executor const exec = utm_sched_executor(sched);
+
+	ASSERT_EQ(utm_split_polygon_parallel(&exec, 1, 5, plat, plon, &par), 2);
+	ASSERT_EQ(par.nvertices, out.nvertices);
+	ASSERT_EQ(par.pieces[1].zone, 31);
+	ASSERT_MEM_EQ(out.easting, par.easting, par.nvertices * sizeof(double));
+	ASSERT_MEM_EQ(
+	    out.northing, par.northing, par.nvertices * sizeof(double));
+	ASSERT_EQ(utm_split_polyline_parallel(NULL, 0, 3, lat, lon, &par), -1);
+	utm_sched_destroy(sched);
+	utm_pieces_free(&par);
+
+	/* A ring around the pole */
+	double const rlat[] = {80.0, 80.0, 80.0, 80.0};
+	double const rlon[] = {0.0, 90.0, 180.0, -90.0};
+	ASSERT_EQ(utm_split_polygon(4, rlat, rlon, &out), -1);
+
+	utm_pieces_free(&out);
+	PASS();
+}
+
+TEST test_track_resample(void)
+{
+	enum { N = 3000, M = 3100 };
+	static double t[N], lat[N], lon[N], ot[M], x[M], y[M];
+	int const zone = 31;
+	size_t count;
+
+	/* Uniform motion in the grid, at irregular times. */
+	for (int i = 0; i < N; ++i) {
+		t[i] = i + 0.4 * sin(i);
+		utm_to_lat_lon(400000.0 + 10.0 * t[i], 4000000.0 + 5.0 * t[i],
+			       zone, 0, &lat[i], &lon[i]);
+	}
+	lat[1500] = NAN;
+	t[1700] = t[1699];
+
+	for (int flags = 0; flags <= UTM_RESAMPLE_HERMITE; ++flags) {
+		ASSERT_EQ(utm_track_resample(N, t, lat, lon, NULL, 0.5, 1.0,
+					     flags, M, ot, x, y, &count),
+			  zone);
+		ASSERT_EQ(count, (size_t)floor(t[N - 1] - 0.5) + 1);
+		for (size_t k = 0; k < count; ++k) {
+			ASSERT_EQ(ot[k], 0.5 + k);
+			ASSERT_IN_RANGE(400000.0 + 10.0 * ot[k], x[k], 1e-3);
+			ASSERT_IN_RANGE(4000000.0 + 5.0 * ot[k], y[k], 1e-3);
+		}
+	}
+
+	/* Hermite interpolation follows a turn more closely. */
+	double const clat[] = {0.0, 0.0, 0.01, 0.01};
+	double const clon[] = {9.0, 9.01, 9.01, 9.0};
+	double const ct[] = {0.0, 1.0, 2.0, 3.0};
+	double hx[8], hy[8];
+
+	utm_track_resample(4, ct, clat, clon, NULL, 0.0, 0.5, 0, 8, ot, x, y,
+			   &count);
+	ASSERT_EQ(count, 7);
+	utm_track_resample(4, ct, clat, clon, NULL, 0.0, 0.5,
+			   UTM_RESAMPLE_HERMITE, 8, ot, hx, hy, &count);
+	ASSERT_EQ(count, 7);
+	ASSERT_EQ(x[2], hx[2]);
+	ASSERT(hx[3] > x[3]);
+
+	/* The output stops when full. */
+	ASSERT_EQ(utm_track_resample(N, t, lat, lon, &zone, 0.0, 1.0, 0, 10,
+				     ot, x, y, &count),
+		  zone);
+	ASSERT_EQ(count, 10);
+
+	ASSERT_EQ(utm_track_resample(N, t, lat, lon, NULL, 0.0, 0.0, 0, M, ot,
+				     x, y, &count),
+		  -1);
+	/* No room for any sample, and no fix at all */
+	ASSERT_EQ(utm_track_resample(N, t, lat, lon, NULL, 0.0, 1.0, 0, 0,
+				     NULL, NULL, NULL, &count),
+		  zone);
+	ASSERT_EQ(count, 0);
+	ASSERT_EQ(utm_track_resample(0, t, lat, lon, NULL, 0.0, 1.0, 0, M, ot,
+				     x, y, &count),
+		  -1);
+	ASSERT_EQ(count, 0);
+
+	/* Decreasing times are rejected before anything is written. */
+	t[2000] = -1.0;
+	x[0] = -1.0;
+	ASSERT_EQ(utm_track_resample(N, t, lat, lon, NULL, 0.0, 1.0, 0, M, ot,
+				     x, y, &count),
+		  -1);
+	ASSERT_EQ(count, 0);
+	ASSERT_EQ(x[0], -1.0);
+
+	PASS();
+}
+
+TEST test_arc_tables(void)
+{
+	enum { N = 4001 };
+	static double lat[N], lon[N], x[N], y[N], tx[N], ty[N];
+	static double ilat[N], ilon[N], tlat[N], tlon[N];
+	int const zone = 31;
+
+	for (int i = 0; i < N; ++i) {
+		lat[i] = -80.0 + 164.0 * i / N;
+		lon[i] = 6.0 * ((i * 31) % N) / N;
+	}
+
+	lat_lon_to_utm_batch(N, lat, lon, &zone, x, y, NULL);
+	utm_to_lat_lon_batch(N, x, y, zone, 0, ilat, ilon);
+
+	ASSERT_EQ(utm_set_arc_tables(1), 0);
+	lat_lon_to_utm_batch(N, lat, lon, &zone, tx, ty, NULL);
+	utm_to_lat_lon_batch(N, x, y, zone, 0, tlat, tlon);
+
+	double sx, sy;
+	lat_lon_to_utm(45.0, 3.0, &zone, &sx, &sy);
+	ASSERT_EQ(utm_set_arc_tables(0), 1);
+
+	for (int i = 0; i < N; ++i) {
+		ASSERT_IN_RANGE(x[i], tx[i], 1e-6);
+		ASSERT_IN_RANGE(y[i], ty[i], 5e-6);
+		if (lat[i] >= 0.0) {
+			ASSERT_IN_RANGE(ilat[i], tlat[i], 5e-11);
+			ASSERT_IN_RANGE(ilon[i], tlon[i], 5e-11);
+		}
+	}
+
+	double rx, ry;
+	lat_lon_to_utm(45.0, 3.0, &zone, &rx, &ry);
+	ASSERT_IN_RANGE(ry, sy, 5e-6);
+
+	/* The shadow sampling compares the tables with the series. */
+	struct utm_shadow_stats st;
+
+	utm_set_arc_tables(1);
+	utm_shadow_reset();
+	ASSERT_EQ(utm_shadow_start(1), 0);
+	lat_lon_to_utm_batch(N, lat, lon, &zone, tx, ty, NULL);
+	utm_shadow_stop();
+	utm_set_arc_tables(0);
+	utm_shadow_snapshot(&st);
+	utm_shadow_reset();
+	ASSERT(st.samples > 0);
+	ASSERT(st.max_error > 0.0 && st.max_error < 5e-6);
+
+	PASS();
+}
+
+TEST test_batch_frame(void)
+{
+	enum { N = 6 };
+	double const lat[N] = {45.0, 45.0, -33.0, 60.0, 0.5, NAN};
+	double const lon[N] = {5.9, 0.1, 2.0, 3.0, 4.0, 3.0};
+	double ve[N], vn[N], heading[N], cov[3 * N];
+	double x[N], y[N], bx[N], by[N], conv[N], k[N];
+	struct utm_frame_vectors v = {ve, vn, heading, cov};
+	int const zone = 31;
+
+	for (int i = 0; i < N; ++i) {
+		ve[i] = 3.0;
+		vn[i] = 4.0;
+		heading[i] = 0.0;
+		cov[3 * i] = 4.0;
+		cov[3 * i + 1] = 1.0;
+		cov[3 * i + 2] = 9.0;
+	}
+
+	ASSERT_EQ(lat_lon_to_utm_batch_frame(N, lat, lon, &zone, &v, x, y,
+					     NULL, &v, conv, k),
+		  1);
+	lat_lon_to_utm_batch(N, lat, lon, &zone, bx, by, NULL);
+
+	double const a = 6378137.0, e2 = 6.69438e-3;
+
+	for (int i = 0; i < N - 1; ++i) {
+		ASSERT_EQ(x[i], bx[i]);
+		ASSERT_EQ(y[i], by[i]);
+
+		/* Against finite differences of the projection: a step
+		   north gives grid north, a step east the scale. */
+		double const d = 1e-5, phi = lat[i] * M_PI / 180.0;
+		double nx, ny, ex, ey;
+		lat_lon_to_utm(lat[i] + d, lon[i], &zone, &nx, &ny);
+		lat_lon_to_utm(lat[i], lon[i] + d, &zone, &ex, &ey);
+
+		double const g = -atan2(nx - x[i], ny - y[i]) * 180.0 / M_PI;
+		double const nu = a / sqrt(1.0 - e2 * sin(phi) * sin(phi));
+		double const ground = nu * cos(phi) * d * M_PI / 180.0;
+
+		ASSERT_IN_RANGE(g, conv[i], 1e-6);
+		ASSERT_IN_RANGE(hypot(ex - x[i], ey - y[i]) / ground, k[i],
+				1e-7);
+
+		/* Heading 0 becomes -convergence; speeds scale by k. */
+		ASSERT_IN_RANGE(fmod(360.0 - conv[i], 360.0), heading[i],
+				1e-9);
+		ASSERT_IN_RANGE(5.0 * k[i], hypot(ve[i], vn[i]), 1e-9);
+		ASSERT_IN_RANGE(13.0 * k[i] * k[i],
+				cov[3 * i] + cov[3 * i + 2], 1e-9);
+	}
+
+	ASSERT(conv[0] > 0.0 && conv[1] < 0.0 && conv[2] > 0.0);
+	ASSERT(isnan(ve[N - 1]) && isnan(conv[N - 1]));
+
+	struct utm_frame_vectors partial = {ve, NULL, NULL, NULL};
+	ASSERT_EQ(lat_lon_to_utm_batch_frame(N, lat, lon, &zone, &partial, x,
+					     y, NULL, &v, NULL, NULL),
+		  -1);
+
+	PASS();
+}
+
+TEST test_graticule(void)
+{
+	struct utm_graticule g = {0};
+	int kinds[4] = {0};
+	int const n = utm_graticule(40.0, -2.0, 50.0, 8.0, 100000.0, 1e-4, &g);
+
+	ASSERT(n > 0);
+	for (int i = 0; i < n; ++i) {
+		struct utm_grid_line const *l = &g.lines[i];
+
+		ASSERT(l->count >= 2);
+		++kinds[l->kind];
+
+		for (size_t j = l->start; j < l->start + l->count; ++j) {
+			ASSERT(g.lat[j] >= 40.0 - 1e-9 &&
+			       g.lat[j] <= 50.0 + 1e-9);
+			ASSERT(g.lon[j] >= -2.0 - 1e-9 &&
+			       g.lon[j] <= 8.0 + 1e-9);
+			if (l->kind > UTM_GRID_NORTHING)
+				continue;
+
+			/* On the line, to the tolerance (about 11 m). */
+			double x, y;
+			lat_lon_to_utm(g.lat[j], g.lon[j], &l->zone, &x, &y);
+			ASSERT_IN_RANGE(l->value,
+					l->kind == UTM_GRID_EASTING ? x : y,
+					12.0);
+		}
+	}
+
+	/* Zones 30 to 32, boundaries at 0 and 6, bands from 40N and 48N */
+	ASSERT_EQ(kinds[UTM_GRID_ZONE], 2);
+	ASSERT_EQ(kinds[UTM_GRID_BAND], 6);
+	ASSERT(kinds[UTM_GRID_EASTING] >= 6);
+	ASSERT(kinds[UTM_GRID_NORTHING] >= 30);
+
+	/* Across the antimeridian, longitudes stay within their zone. */
+	ASSERT(utm_graticule(-10.0, 170.0, 10.0, -170.0, 10000.0, 1e-3, &g) >
+	       0);
+	for (size_t i = 0; i < g.nlines; ++i) {
+		struct utm_grid_line const *l = &g.lines[i];
+		double const cm = -183.0 + 6.0 * l->zone;
+
+		for (size_t j = l->start; j < l->start + l->count; ++j)
+			ASSERT(fabs(g.lon[j] - cm) <= 3.0 + 1e-9 ||
+			       l->kind == UTM_GRID_ZONE);
+	}
+
+	ASSERT_EQ(utm_graticule(50.0, 0.0, 40.0, 6.0, 1000.0, 1e-4, &g), -1);
+	ASSERT_EQ(utm_graticule(40.0, 0.0, 50.0, 6.0, 0.0, 1e-4, &g), -1);
+	ASSERT_EQ(utm_graticule(40.0, 0.0, 50.0, 6.0, 1e-9, 1e-4, &g), -1);
+
+	/* A tolerance far below a pixel is still met by every chord. */
+	ASSERT(utm_graticule(45.0, 1.0, 45.5, 1.5, 20000.0, 1e-9, &g) > 0);
+	for (size_t i = 0; i < g.nlines; ++i) {
+		struct utm_grid_line const *l = &g.lines[i];
+
+		if (l->kind != UTM_GRID_EASTING)
+			continue;
+		for (size_t j = l->start; j + 1 < l->start + l->count; ++j) {
+			double xm, ym;
+			int const zone = l->zone;
+
+			/* Midpoints of the chords are on the line. */
+			lat_lon_to_utm(0.5 * (g.lat[j] + g.lat[j + 1]),
+				       0.5 * (g.lon[j] + g.lon[j + 1]), &zone,
+				       &xm, &ym);
+			ASSERT_IN_RANGE(l->value, xm, 1e-3);
+		}
+	}
+	ASSERT_EQ(utm_graticule(84.5, 0.0, 89.0, 6.0, 1000.0, 1e-4, &g), 0);
+
+	utm_graticule_free(&g);
+	PASS();
+}
+
+TEST test_batch_ground(void)
+{
+	enum { N = 3 };
+	double const lat[N] = {45.0, 45.0, 45.0};
+	double const lon[N] = {4.5, 4.501, 4.5};
+	double const h[N] = {1500.0, 1500.0, 0.0};
+	double x[N], y[N], bx[N], by[N], cf[N], conv[N], k[N];
+	int const zone = 31;
+
+	ASSERT_EQ(lat_lon_to_utm_batch_ground(N, lat, lon, h, &zone, NULL, x,
+					      y, NULL, cf),
+		  0);
+	lat_lon_to_utm_batch_frame(N, lat, lon, &zone, NULL, bx, by, NULL,
+				   NULL, conv, k);
+
+	ASSERT_EQ(x[0], bx[0]);
+	ASSERT_EQ(y[0], by[0]);
+	ASSERT_IN_RANGE(k[2], cf[2], 1e-15);
+	ASSERT_IN_RANGE(k[0] * (1.0 - 1500.0 / 6.37e6), cf[0], 1e-6);
+
+	/* Ground coordinates give ground distances near the origin: the
+	   ellipsoid distance between the points scaled to the height. */
+	struct utm_ground_system sys;
+	double gx[N], gy[N], rx[N], ry[N];
+
+	ASSERT_EQ(utm_ground_system_init(&sys, 45.0, 4.5, 1500.0, NULL), 31);
+	ASSERT_EQ(sys.factor, cf[0]);
+	ASSERT_EQ(lat_lon_to_utm_batch_ground(2, lat, lon, h, NULL, &sys, gx,
+					      gy, NULL, NULL),
+		  0);
+
+	double const a = 6378137.0, e2 = 6.69437999e-3, phi = M_PI / 4.0;
+	double const nu = a / sqrt(1.0 - e2 * sin(phi) * sin(phi));
+	double const rho = nu * (1.0 - e2) / (1.0 - e2 * sin(phi) * sin(phi));
+	double const ds = nu * cos(phi) * 0.001 * M_PI / 180.0;
+	double const r = sqrt(nu * rho);
+
+	ASSERT_IN_RANGE(ds * (r + 1500.0) / r,
+			hypot(gx[1] - gx[0], gy[1] - gy[0]), 1e-4);
+	ASSERT_IN_RANGE(sys.easting, gx[0], 1e-9);
+
+	ASSERT_EQ(utm_ground_to_grid(&sys, 2, gx, gy, rx, ry), 0);
+	ASSERT_IN_RANGE(x[1], rx[1], 1e-8);
+	ASSERT_IN_RANGE(y[1], ry[1], 1e-8);
+	ASSERT_EQ(utm_grid_to_ground(&sys, 2, rx, ry, rx, ry), 0);
+	ASSERT_IN_RANGE(gx[1], rx[1], 1e-8);
+
+	ASSERT_EQ(utm_ground_system_init(&sys, NAN, 4.5, 0.0, NULL), -1);
+
+	PASS();
+}
+
+TEST test_batch_epoch(void)
+{
+	char dir[] = "/tmp/utm-vel-XXXXXX", path[64];
+	struct utm_velocity_header h = {
+	    UTM_VELOCITY_MAGIC, 3, 3, 40.0, 0.0, 5.0, 5.0};
+	double nodes[3][3][2];
+	FILE *f;
+
+	for (int i = 0; i < 3; ++i)
+		for (int j = 0; j < 3; ++j) {
+			nodes[i][j][0] = 0.02 + 0.001 * j;
+			nodes[i][j][1] = 0.01 + 0.002 * i;
+		}
+
+	ASSERT(mkdtemp(dir));
+	snprintf(path, sizeof path, "%s/grid", dir);
+	ASSERT((f = fopen(path, "wb")));
+	fwrite(&h, sizeof h, 1, f);
+	fwrite(nodes, sizeof nodes, 1, f);
+	fclose(f);
+
+	struct utm_velocity_grid *grid = utm_velocity_grid_open(path);
+	double ve, vn;
+
+	ASSERT(grid);
+	ASSERT_EQ(utm_velocity_grid_at(grid, 42.5, 7.5, &ve, &vn), 0);
+	ASSERT_IN_RANGE(0.0215, ve, 1e-15);
+	ASSERT_IN_RANGE(0.011, vn, 1e-15);
+	ASSERT_EQ(utm_velocity_grid_at(grid, 50.0, 10.0, &ve, &vn), 0);
+	ASSERT_IN_RANGE(0.014, vn, 1e-15);
+	ASSERT_EQ(utm_velocity_grid_at(grid, 39.9, 5.0, &ve, &vn), -1);
+
+	/* Against moving the points in latitude/longitude first */
+	double const lat[3] = {45.0, 42.5, 60.0};
+	double const lon[3] = {2.0, 7.5, 2.0};
+	double const epoch[3] = {2005.0, 2020.5, 2010.0};
+	double x[3], y[3];
+	int const zone = 31;
+
+	ASSERT_EQ(lat_lon_to_utm_batch_epoch(3, lat, lon, epoch, 2020.0, grid,
+					     &zone, x, y, NULL),
+		  1);
+	ASSERT(isnan(x[2]));
+
+	for (int i = 0; i < 2; ++i) {
+		double const a = 6378137.0, e2 = 6.69437999014e-3;
+		double const phi = lat[i] * M_PI / 180.0;
+		double const w2 = 1.0 - e2 * sin(phi) * sin(phi);
+		double const nu = a / sqrt(w2), rho = nu * (1.0 - e2) / w2;
+		double const dt = 2020.0 - epoch[i];
+		double mx, my;
+
+		utm_velocity_grid_at(grid, lat[i], lon[i], &ve, &vn);
+		double const mlat = lat[i] + vn * dt / rho * 180.0 / M_PI;
+		double const mlon =
+		    lon[i] + ve * dt / (nu * cos(phi)) * 180.0 / M_PI;
+
+		lat_lon_to_utm(mlat, mlon, &zone, &mx, &my);
+		ASSERT_IN_RANGE(mx, x[i], 1e-6);
+		ASSERT_IN_RANGE(my, y[i], 1e-6);
+	}
+
+	utm_velocity_grid_close(grid);
+
+	ASSERT((f = fopen(path, "wb")));
+	fwrite(&h, sizeof h, 1, f);
+	fclose(f);
+	ASSERT_EQ(utm_velocity_grid_open(path), NULL);
+
+	remove(path);
+	remove(dir);
+	PASS();
+}
+
+TEST test_batch_subset(void)
+{
+	enum { N = 200 };
+	double lat[N], lon[N], x[N], y[N], sx[N], sy[N];
+	int zones[N], sz[N];
+	size_t index[N], m = 0;
+	uint64_t mask[(N + 63) / 64] = {0};
+
+	for (int i = 0; i < N; ++i) {
+		lat[i] = -80.0 + 0.8 * i;
+		lon[i] = -170.0 + 1.7 * i;
+	}
+	lat[42] = NAN;
+	lat_lon_to_utm_batch(N, lat, lon, NULL, x, y, zones);
+
+	/* Every third row, and a row past n in the mask to be ignored */
+	for (size_t i = 0; i < N; i += 3) {
+		index[m++] = i;
+		mask[i / 64] |= (uint64_t)1 << (i % 64);
+	}
+	mask[N / 64] |= (uint64_t)1 << 63;
+
+	ASSERT_EQ(lat_lon_to_utm_batch_indexed(
+		      N, lat, lon, m, index, NULL, sx, sy, sz, 0),
+		  1);
+	for (size_t k = 0; k < m; ++k) {
+		ASSERT_EQ(zones[index[k]], sz[k]);
+		if (sz[k] > 0) {
+			ASSERT_EQ(x[index[k]], sx[k]);
+			ASSERT_EQ(y[index[k]], sy[k]);
+		}
+	}
+
+	for (int i = 0; i < N; ++i)
+		sx[i] = sy[i] = -1.0;
+	int const failed = lat_lon_to_utm_batch_masked(
+	    N, lat, lon, mask, NULL, sx, sy, NULL, UTM_SUBSET_SCATTER);
+	ASSERT_EQ(failed, 1);
+	for (int i = 0; i < N; ++i) {
+		if (i % 3) {
+			ASSERT_EQ(-1.0, sx[i]);
+		} else if (zones[i] > 0) {
+			ASSERT_EQ(x[i], sx[i]);
+			ASSERT_EQ(y[i], sy[i]);
+		}
+	}
+
+	index[0] = N;
+	ASSERT_EQ(lat_lon_to_utm_batch_indexed(
+		      N, lat, lon, m, index, NULL, sx, sy, sz, 0),
+		  -1);
+	PASS();
+}
+
+SUITE(test_batch)
+{
+	RUN_TEST(test_lat_lon_to_utm_batch_matches_scalar);
+	RUN_TEST(test_utm_to_lat_lon_batch_matches_scalar);
+	RUN_TEST(test_lat_lon_to_utm_batch_dd);
+	RUN_TEST(test_lat_lon_to_utm_batch_ext);
+	RUN_TEST(test_lat_lon_to_utm_batch_ext_err);
+	RUN_TEST(test_lat_lon_to_utm_multi);
+	RUN_TEST(test_lat_lon_to_utm_batch_seam);
+	RUN_TEST(test_batch_invalid);
+	RUN_TEST(test_shadow_sampling);
+	RUN_TEST(test_track_simplify);
+	RUN_TEST(test_point_buffer);
+	RUN_TEST(test_batch_aosoa);
+	RUN_TEST(test_split_geometry);
+	RUN_TEST(test_track_resample);
+	RUN_TEST(test_arc_tables);
+	RUN_TEST(test_batch_frame);
+	RUN_TEST(test_graticule);
+	RUN_TEST(test_batch_ground);
+	RUN_TEST(test_batch_epoch);
+	RUN_TEST(test_batch_subset);
+}
+
+TEST test_projection_from_epsg(void)
+{
+	struct utm_projection const *proj;
+
+	proj = utm_projection_from_epsg(32629);
+	ASSERT(proj);
+	ASSERT_EQ(utm_projection_zone(proj), 29);
+	ASSERT_EQ(utm_projection_southhemi(proj), 0);
+	ASSERT_EQ(utm_projection_epsg(proj), 32629);
+
+	proj = utm_projection_from_epsg(32760);
+	ASSERT(proj);
+	ASSERT_EQ(utm_projection_zone(proj), 60);
+	ASSERT_EQ(utm_projection_southhemi(proj), 1);
+	ASSERT_EQ(proj, utm_projection_from_zone(60, 1));
+
+	ASSERT_EQ(utm_projection_from_epsg(32600), NULL);
+	ASSERT_EQ(utm_projection_from_epsg(32661), NULL);
+	ASSERT_EQ(utm_projection_from_epsg(32700), NULL);
+	ASSERT_EQ(utm_projection_from_epsg(4326), NULL);
+	ASSERT_EQ(utm_projection_from_zone(0, 0), NULL);
+	ASSERT_EQ(utm_projection_zone(NULL), -1);
+
+	PASS();
+}
+
+TEST test_projection_forward_inverse(void)
+{
+	double const lat[] = {45.333988, 32.871032, -27.298790, -78.123978};
+	double const lon[] = {-134.982133, -10.923898, 89.011000, 11.037809};
+	int const epsg[] = {32608, 32629, 32745, 32732};
+	double x, y, plat, plon;
+
+	for (int i = 0; i < 4; ++i) {
+		struct utm_projection const *proj =
+		    utm_projection_from_epsg(epsg[i]);
+		int const zone = utm_projection_zone(proj);
+		double easting, northing;
+
+		ASSERT_EQ(
+		    utm_projection_forward(proj, 1, &lat[i], &lon[i], &x, &y),
+		    0);
+		lat_lon_to_utm(lat[i], lon[i], &zone, &easting, &northing);
+		ASSERT_IN_RANGE(easting, x, 1e-6);
+		ASSERT_IN_RANGE(northing, y, 1e-6);
+
+		ASSERT_EQ(
+		    utm_projection_inverse(proj, 1, &x, &y, &plat, &plon), 0);
+		ASSERT_IN_RANGE(lat[i], plat, TEST_TOLERANCE_DEG);
+		ASSERT_IN_RANGE(lon[i], plon, TEST_TOLERANCE_DEG);
+	}
+
+	/* A southern point in a north zone keeps its negative northing. */
+	struct utm_projection const *north = utm_projection_from_epsg(32645);
+	ASSERT_EQ(utm_projection_forward(north, 1, &lat[2], &lon[2], &x, &y),
+		  0);
+	ASSERT_IN_RANGE(6978868.08 - 10000000.0, y, TEST_TOLERANCE_M);
+
+	ASSERT_EQ(utm_projection_forward(NULL, 1, lat, lon, &x, &y), -1);
+
+	PASS();
+}
+
+SUITE(test_projection)
+{
+	RUN_TEST(test_projection_from_epsg);
+	RUN_TEST(test_projection_forward_inverse);
+}
+
+static void mark_range(void *arg, size_t begin, size_t end)
+{
+	int *hits = arg;
+
+	for (size_t i = begin; i < end; ++i)
+		++hits[i];
+}
+
+struct nested {
+	struct utm_sched *sched;
+	int rejected;
+};
+
+// Calls the scheduler running it, which must be rejected.
+static void nested_range(void *arg, size_t begin, size_t end)
+{
+	struct nested *n = arg;
+
+	(void)begin;
+	(void)end;
+	if (utm_sched_parallel_for(n->sched, 1, 1, nested_range, arg) == -1)
+		__atomic_fetch_add(&n->rejected, 1, __ATOMIC_RELAXED);
+}
+
+TEST test_sched_parallel_for(void)
+{
+	enum { N = 10007 };
+	static int hits[N];
+	struct utm_sched *sched = utm_sched_create(4);
+
+	ASSERT(sched);
+	ASSERT(utm_sched_threads(sched) >= 1);
+
+	for (int run = 0; run < 3; ++run) {
+		ASSERT_EQ(utm_sched_parallel_for(sched, N, 7, mark_range, hits),
+			  0);
+		for (int i = 0; i < N; ++i)
+			ASSERT_EQ(hits[i], run + 1);
+	}
+
+	struct nested nested = {sched, 0};
+	ASSERT_EQ(utm_sched_parallel_for(sched, 64, 1, nested_range, &nested),
+		  0);
+	ASSERT_EQ(nested.rejected, 64);
+
+	ASSERT_EQ(utm_sched_parallel_for(sched, N, 1, NULL, hits), -1);
+	ASSERT_EQ(utm_sched_parallel_for(NULL, N, 1, mark_range, hits), -1);
+	ASSERT_EQ(utm_sched_threads(NULL), -1);
+
+	utm_sched_destroy(sched);
+	PASS();
+}
+
+TEST test_sched_convert(void)
+{
+	enum { N = 3000 };
+	static double lat[N], lon[N], x[N], y[N], ilat[N], ilon[N];
+	static double bx[N], by[N], blat[N], blon[N];
+	static int zones[N], bzones[N];
+	struct utm_sched *sched = utm_sched_create(3);
+
+	ASSERT(sched);
+
+	for (int i = 0; i < N; ++i) {
+		lat[i] = -79.0 + 158.0 * i / N;
+		lon[i] = -179.0 + 358.0 * ((i * 7919) % N) / N;
+		x[i] = 200000.0 + 200.0 * (i % 3000);
+		y[i] = 1100000.0 + 1500.0 * i;
+	}
+
+	/* Skewed job sizes, mixing forward and inverse jobs. */
+	struct utm_job const jobs[] = {
+	    {0, 2500, lat, lon, bx, by, bzones, 0, 0},
+	    {0, 0, NULL, NULL, NULL, NULL, NULL, 0, 0},
+	    {0, 3, lat + 2500, lon + 2500, bx + 2500, by + 2500, bzones + 2500,
+	     0, 0},
+	    {0, 497, lat + 2503, lon + 2503, bx + 2503, by + 2503, NULL, 31, 0},
+	    {1, N, blat, blon, x, y, NULL, 33, 1},
+	};
+
+	ASSERT_EQ(utm_sched_convert(sched, jobs, 5, 64), 0);
+
+	lat_lon_to_utm_batch(2503, lat, lon, NULL, ilat, ilon, zones);
+	for (int i = 0; i < 2503; ++i) {
+		ASSERT_EQ(zones[i], bzones[i]);
+		ASSERT_EQ(ilat[i], bx[i]);
+		ASSERT_EQ(ilon[i], by[i]);
+	}
+
+	int const zone = 31;
+	lat_lon_to_utm_batch(497, lat + 2503, lon + 2503, &zone, ilat, ilon,
+			     NULL);
+	for (int i = 0; i < 497; ++i) {
+		ASSERT_EQ(ilat[i], bx[2503 + i]);
+		ASSERT_EQ(ilon[i], by[2503 + i]);
+	}
+
+	utm_to_lat_lon_batch(N, x, y, 33, 1, ilat, ilon);
+	for (int i = 0; i < N; ++i) {
+		ASSERT_EQ(ilat[i], blat[i]);
+		ASSERT_EQ(ilon[i], blon[i]);
+	}
+
+	struct utm_job const bad = {1, 1, lat, lon, x, y, NULL, 0, 0};
+	ASSERT_EQ(utm_sched_convert(sched, &bad, 1, 0), -1);
+
+	utm_sched_destroy(sched);
+	PASS();
+}
+
+// Executor of test_executor: runs the tasks in reverse order when waited for,
+// and refuses every fourth one.
+struct deferred {
+	struct {
+		utm_range_fn fn;
+		void *arg;
+		size_t begin, end;
+	} tasks[64];
+	int ntasks, submits, waits;
+};
+
+static int deferred_submit(
+    void *ctx, utm_range_fn fn, void *arg, size_t begin, size_t end)
+{
+	struct deferred *d = ctx;
+
+	if (++d->submits % 4 == 0 || d->ntasks == 64)
+		return -1;
+
+	d->tasks[d->ntasks].fn = fn;
+	d->tasks[d->ntasks].arg = arg;
+	d->tasks[d->ntasks].begin = begin;
+	d->tasks[d->ntasks].end = end;
+	++d->ntasks;
+	return 0;
+}
+
+static void deferred_wait(void *ctx)
+{
+	struct deferred *d = ctx;
+
+	while (d->ntasks) {
+		--d->ntasks;
+		d->tasks[d->ntasks].fn(d->tasks[d->ntasks].arg,
+				       d->tasks[d->ntasks].begin,
+				       d->tasks[d->ntasks].end);
+	}
+	++d->waits;
+}
+
+TEST test_executor(void)
+{
+	enum { N = 1000 };
+	static double lat[N], lon[N], x[N], y[N], px[N], py[N];
+	static double ilat[N], ilon[N], plat[N], plon[N];
+	static int zones[N], pzones[N];
+	struct deferred d = {.ntasks = 0};
+	struct utm_executor const mine = {deferred_submit, deferred_wait, &d};
+	struct utm_sched *sched = utm_sched_create(3);
+	struct utm_executor const pool = utm_sched_executor(sched);
+
+	ASSERT(sched);
+
+	for (int i = 0; i < N; ++i) {
+		lat[i] = -79.0 + 158.0 * i / N;
+		lon[i] = -179.0 + 358.0 * ((i * 7919) % N) / N;
+	}
+	lat[17] = NAN;
+
+	lat_lon_to_utm_batch(N, lat, lon, NULL, x, y, zones);
+	utm_to_lat_lon_batch(N, x, y, 33, 1, ilat, ilon);
+
+	ASSERT_EQ(lat_lon_to_utm_batch_parallel(
+		      &mine, 50, N, lat, lon, NULL, px, py, pzones),
+		  1);
+	ASSERT_EQ(d.submits, 20);
+	ASSERT_EQ(d.waits, 1);
+	ASSERT_EQ(memcmp(zones, pzones, sizeof zones), 0);
+	ASSERT_EQ(memcmp(x + 18, px + 18, (N - 18) * sizeof *x), 0);
+
+	ASSERT_EQ(lat_lon_to_utm_batch_parallel(
+		      &pool, 7, N, lat, lon, NULL, px, py, NULL),
+		  1);
+	ASSERT_EQ(memcmp(y + 18, py + 18, (N - 18) * sizeof *y), 0);
+
+	for (int k = 0; k < 2; ++k) {
+		struct utm_executor const *exec = k ? &pool : &mine;
+
+		ASSERT_EQ(utm_to_lat_lon_batch_parallel(
+			      exec, 0, N, x, y, 33, 1, plat, plon),
+			  0);
+		ASSERT_EQ(memcmp(ilat, plat, sizeof ilat), 0);
+		ASSERT_EQ(memcmp(ilon, plon, sizeof ilon), 0);
+	}
+
+	int const zone = 61;
+	ASSERT_EQ(lat_lon_to_utm_batch_parallel(
+		      &pool, 0, N, lat, lon, &zone, px, py, NULL),
+		  -1);
+	ASSERT_EQ(lat_lon_to_utm_batch_parallel(
+		      NULL, 0, N, lat, lon, NULL, px, py, NULL),
+		  -1);
+
+	utm_sched_destroy(sched);
+	PASS();
+}
+
+static void store_keys(void *arg, struct utm_block *b)
+{
+	uint64_t *keys = arg;
+
+	for (size_t i = 0; i < b->n; ++i)
+		keys[b->offset + i] = b->key[i];
+}
+
+TEST test_pipeline(void)
+{
+	enum { N = 5000 };
+	static double lat[N], lon[N], x[N], y[N];
+	static uint64_t keys[N];
+	unsigned long long counts[16] = {0}, expect[16] = {0};
+	int const zone = 31;
+	struct utm_sched *sched = utm_sched_create(3);
+	struct utm_executor const pool = utm_sched_executor(sched);
+	struct utm_pipeline *p = utm_pipeline_create();
+
+	ASSERT(sched && p);
+
+	/* Stages reading columns which nothing writes yet */
+	ASSERT_EQ(utm_pipeline_key(p), -1);
+	ASSERT_EQ(utm_pipeline_quantize(p, 0.0, 0.0, 10.0), -1);
+
+	ASSERT_EQ(utm_pipeline_project(p, &zone), 0);
+	ASSERT_EQ(utm_pipeline_quantize(p, 400000.0, 4900000.0, 1e-4), 0);
+	ASSERT_EQ(utm_pipeline_key(p), 0);
+	ASSERT_EQ(utm_pipeline_stage(p, store_keys, keys), 0);
+	ASSERT_EQ(utm_pipeline_bin(p, 4, counts), 0);
+	ASSERT_EQ(utm_pipeline_bin(p, 0, counts), -1);
+
+	for (int i = 0; i < N; ++i) {
+		lat[i] = 44.0 + 2.0 * ((i * 7919) % N) / N;
+		lon[i] = 1.0 + 3.0 * i / N;
+	}
+	lat[99] = NAN;
+
+	ASSERT_EQ(utm_pipeline_run(p, &pool, N, lat, lon, 128), 1);
+	ASSERT_EQ(utm_pipeline_run(p, NULL, N, lat, lon, 0), 1);
+
+	lat_lon_to_utm_batch(N, lat, lon, &zone, x, y, NULL);
+	for (int i = 0; i < N; ++i) {
+		double const qx = floor((x[i] - 400000.0) / 1e-4);
+		double const qy = floor((y[i] - 4900000.0) / 1e-4);
+		uint64_t k = 0;
+
+		if (isnan(x[i]) || qx < 0.0 || qy < 0.0) {
+			ASSERT_EQ(UTM_KEY_NONE, keys[i]);
+			continue;
+		}
+
+		for (int b = 0; b < 32; ++b)
+			k |= ((uint64_t)qx >> b & 1) << 2 * b |
+			     ((uint64_t)qy >> b & 1) << (2 * b + 1);
+		ASSERT_EQ(k, keys[i]);
+		expect[k >> 60] += 2;
+	}
+	ASSERT(counts[0] && counts[1] && counts[2]);
+	ASSERT_EQ(memcmp(expect, counts, sizeof counts), 0);
+
+	utm_pipeline_destroy(p);
+	utm_sched_destroy(sched);
+	PASS();
+}
+
+TEST test_autotune(void)
+{
+	struct utm_tune_config config, loaded;
+	char dir[] = "/tmp/utm-tune-XXXXXX", path[64];
+	FILE *f;
+
+	ASSERT_EQ(utm_autotune(&config), 0);
+	ASSERT(config.kernel == UTM_KERNEL_SERIES ||
+	       config.kernel == UTM_KERNEL_TABLES);
+	ASSERT(config.nthreads >= 1);
+	ASSERT(config.grain >= 1024 && config.grain <= 65536);
+	ASSERT_STR_EQ(utm_tune_kernel(), "series");
+
+	ASSERT(mkdtemp(dir));
+	snprintf(path, sizeof path, "%s/tune", dir);
+	ASSERT_EQ(utm_tune_save(path, &config), 0);
+	ASSERT_EQ(utm_tune_load(path, &loaded), 0);
+	ASSERT_EQ(loaded.kernel, config.kernel);
+	ASSERT_EQ(loaded.nthreads, config.nthreads);
+	ASSERT_EQ(loaded.grain, config.grain);
+
+	/* The configuration in use is picked up by the scheduler. */
+	struct utm_tune_config const tuned = {UTM_KERNEL_TABLES, 3, 2048};
+	ASSERT_EQ(utm_tune_apply(&tuned), 0);
+	ASSERT_STR_EQ(utm_tune_kernel(), "tables");
+	utm_tune_current(&loaded);
+	ASSERT_EQ(loaded.kernel, UTM_KERNEL_TABLES);
+	ASSERT_EQ(loaded.grain, 2048);
+
+	struct utm_sched *s = utm_sched_create(0);
+	ASSERT(s);
+	ASSERT_EQ(utm_sched_threads(s), 3);
+	utm_sched_destroy(s);
+
+	struct utm_tune_config const defaults = {UTM_KERNEL_SERIES, 0, 0};
+	ASSERT_EQ(utm_tune_apply(&defaults), 0);
+	ASSERT_STR_EQ(utm_tune_kernel(), "series");
+
+	/* A saved configuration keeps the kernel chosen by the application. */
+	utm_set_arc_tables(0);
+	ASSERT_EQ(utm_tune_save(path, &tuned), 0);
+	ASSERT_EQ(utm_tune_use_saved(path), 0);
+	ASSERT_STR_EQ(utm_tune_kernel(), "series");
+	utm_tune_current(&loaded);
+	ASSERT_EQ(loaded.nthreads, 3);
+	ASSERT_EQ(utm_tune_apply(&defaults), 0);
+
+	ASSERT((f = fopen(path, "w")));
+	fputs("utm-tune 1\nkernel simd\n", f);
+	fclose(f);
+	ASSERT_EQ(utm_tune_load(path, &loaded), -1);
+
+	remove(path);
+	remove(dir);
+	PASS();
+}
+
+SUITE(test_sched)
+{
+	RUN_TEST(test_sched_parallel_for);
+	RUN_TEST(test_sched_convert);
+	RUN_TEST(test_executor);
+	RUN_TEST(test_pipeline);
+	RUN_TEST(test_autotune);
+}
+
+static char *read_file(char const *path, size_t *len)
+{
+	FILE *f = fopen(path, "rb");
+	char *buf = NULL;
+
+	if (!f)
+		return NULL;
+
+	fseek(f, 0, SEEK_END);
+	*len = (size_t)ftell(f);
+	rewind(f);
+
+	buf = malloc(*len + 1);
+	if (buf && fread(buf, 1, *len, f) != *len) {
+		free(buf);
+		buf = NULL;
+	}
+	if (buf)
+		buf[*len] = '\0';
+
+	fclose(f);
+	return buf;
+}
+
+TEST test_run_manifest_resume(void)
+{
+	enum { N = 2000 };
+	char dir[] = "/tmp/utm-test-XXXXXX";
+	char in[64], out[64], manifest[64], journal[64];
+	struct utm_run_options const opts = {2, 4096, 0};
+	struct utm_run_stats stats;
+	double lat[N], lon[N], x[N], y[N];
+	int zones[N];
+	FILE *f;
+
+	ASSERT(mkdtemp(dir));
+	snprintf(in, sizeof in, "%s/in", dir);
+	snprintf(out, sizeof out, "%s/out", dir);
+	snprintf(manifest, sizeof manifest, "%s/manifest", dir);
+	snprintf(journal, sizeof journal, "%s/journal", dir);
+
+	ASSERT((f = fopen(in, "w")));
+	for (int i = 0; i < N; ++i) {
+		lat[i] = -79.5 + 163.0 * i / N;
+		lon[i] = -179.5 + 359.0 * ((i * 7919) % N) / N;
+		fprintf(f, "%.7f,%.7f\n", lat[i], lon[i]);
+	}
+	fprintf(f, "not a point\n");
+	fclose(f);
+
+	ASSERT((f = fopen(manifest, "w")));
+	fprintf(f, "# test\n%s %s\n", in, out);
+	fclose(f);
+
+	ASSERT_EQ(utm_run_manifest(manifest, journal, &opts, &stats), 0);
+	ASSERT_EQ(stats.files, 1);
+	ASSERT(stats.chunks > 2);
+	ASSERT_EQ(stats.points, N + 1);
+	ASSERT_EQ(stats.points_failed, 1);
+
+	/* The output matches the batch conversion of the rounded input. */
+	ASSERT((f = fopen(in, "r")));
+	for (int i = 0; i < N; ++i)
+		ASSERT_EQ(fscanf(f, "%lf,%lf", &lat[i], &lon[i]), 2);
+	fclose(f);
+	lat_lon_to_utm_batch(N, lat, lon, NULL, x, y, zones);
+
+	ASSERT((f = fopen(out, "r")));
+	for (int i = 0; i < N; ++i) {
+		double e, n;
+		int zone;
+
+		ASSERT_EQ(fscanf(f, "%lf %lf %d", &e, &n, &zone), 3);
+		ASSERT_EQ(zone, zones[i]);
+		ASSERT_IN_RANGE(x[i], e, 1e-4);
+		ASSERT_IN_RANGE(y[i], n, 1e-4);
+	}
+	fclose(f);
+
+	size_t ref_len, len;
+	char *ref = read_file(out, &ref_len);
+	ASSERT(ref);
+
+	/* Interrupt after two chunks: a torn record and a partial chunk. */
+	char *jbuf = read_file(journal, &len);
+	ASSERT(jbuf);
+	char *cut = jbuf;
+	for (int i = 0; i < 3; ++i)
+		cut = strchr(cut, '\n') + 1;
+	ASSERT((f = fopen(journal, "w")));
+	fwrite(jbuf, 1, (size_t)(cut - jbuf), f);
+	fprintf(f, "0 12");
+	fclose(f);
+	free(jbuf);
+
+	ASSERT((f = fopen(out, "a")));
+	fprintf(f, "partial line");
+	fclose(f);
+
+	ASSERT_EQ(utm_run_manifest(manifest, journal, &opts, &stats), 0);
+	ASSERT(stats.bytes_resumed > 0);
+	ASSERT(stats.points < N + 1);
+
+	char *res = read_file(out, &len);
+	ASSERT(res);
+	ASSERT_EQ(len, ref_len);
+	ASSERT_MEM_EQ(ref, res, len);
+	free(res);
+	free(ref);
+
+	/* A complete run is skipped. */
+	ASSERT_EQ(utm_run_manifest(manifest, journal, NULL, &stats), 0);
+	ASSERT_EQ(stats.files_skipped, 1);
+	ASSERT_EQ(stats.chunks, 0);
+
+	/* Another input of the same size on that line is not skipped. */
+	char other[64];
+	snprintf(other, sizeof other, "%s/other", dir);
+	ASSERT_EQ(rename(in, other), 0);
+	ASSERT((f = fopen(manifest, "w")));
+	fprintf(f, "%s %s\n", other, out);
+	fclose(f);
+
+	ASSERT_EQ(utm_run_manifest(manifest, journal, NULL, &stats), 0);
+	ASSERT_EQ(stats.files_skipped, 0);
+	ASSERT_EQ(stats.bytes_resumed, 0);
+	ASSERT_EQ(stats.points, N + 1);
+	ASSERT_EQ(rename(other, in), 0);
+
+	remove(in);
+	remove(out);
+	remove(manifest);
+	remove(journal);
+	remove(dir);
+
+	PASS();
+}
+
+SUITE(test_runner)
+{
+	RUN_TEST(test_run_manifest_resume);
+}
+
 GREATEST_MAIN_DEFS();
 
 int main(int argc, char **argv)
 {
 	GREATEST_MAIN_BEGIN();
 
+	/* Do not pick up the configuration of the host. */
+	setenv("UTM_TUNE_FILE", "", 1);
+
 	RUN_SUITE(test_utm_to_lat_lon);
 	RUN_SUITE(test_lat_lon_to_utm);
+	RUN_SUITE(test_batch);
+	RUN_SUITE(test_projection);
+	RUN_SUITE(test_sched);
+	RUN_SUITE(test_runner);
 
 	GREATEST_MAIN_END();
 }
@@ -0,0 +1,443 @@
+// This file is part of utm.
+
+// (c) Copyright 2019 Miguel Aguiar.
+//
+// This program is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option) any
+// later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU Lesser General Public License for more details.
+
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utm/track.h"
+#include "utm/utm.h"
+
+// Points projected at once
+#define TRACK_BLOCK 1024
+
+// Capacity of the window of points not yet flushed
+#define WINDOW_CAP (4 * TRACK_BLOCK)
+
+struct window {
+	double *x, *y;
+	size_t *index;
+	unsigned char *keep;
+	size_t *stack; /* Pending intervals of the simplification */
+	size_t len;
+};
+
+struct output {
+	double *x, *y;
+	size_t *index;
+	size_t count;
+};
+
+// Squared distance from p to the segment ab.
+static double segment_dist2(
+    double px, double py, double ax, double ay, double bx, double by)
+{
+	double const dx = bx - ax, dy = by - ay;
+	double const len2 = dx * dx + dy * dy;
+	double t = 0.0;
+
+	if (len2 > 0.0) {
+		t = ((px - ax) * dx + (py - ay) * dy) / len2;
+		t = t < 0.0 ? 0.0 : t > 1.0 ? 1.0 : t;
+	}
+
+	double const ex = ax + t * dx - px, ey = ay + t * dy - py;
+	return ex * ex + ey * ey;
+}
+
+// Marks the vertices of the window retained by Douglas-Peucker.  The
+// recursion is replaced by a stack of intervals, of which there are never
+// more than the points in the window.
+static void simplify(struct window *w, double tol2)
+{
+	size_t top = 0;
+
+	memset(w->keep, 0, w->len);
+	w->keep[0] = w->keep[w->len - 1] = 1;
+
+	w->stack[top++] = 0;
+	w->stack[top++] = w->len - 1;
+
+	while (top) {
+		size_t const b = w->stack[--top];
+		size_t const a = w->stack[--top];
+		size_t far = a;
+		double dmax = tol2;
+
+		for (size_t i = a + 1; i < b; ++i) {
+			double const d = segment_dist2(w->x[i],
+						       w->y[i],
+						       w->x[a],
+						       w->y[a],
+						       w->x[b],
+						       w->y[b]);
+			if (d > dmax) {
+				dmax = d;
+				far = i;
+			}
+		}
+
+		if (far == a)
+			continue;
+
+		w->keep[far] = 1;
+		w->stack[top++] = a;
+		w->stack[top++] = far;
+		w->stack[top++] = far;
+		w->stack[top++] = b;
+	}
+}
+
+static void emit(struct output *out, struct window const *w, size_t i)
+{
+	out->x[out->count] = w->x[i];
+	out->y[out->count] = w->y[i];
+	if (out->index)
+		out->index[out->count] = w->index[i];
+	++out->count;
+}
+
+// Projects the next points of the track into the window, dropping the ones
+// which cannot be converted.
+static size_t fill(struct window *w,
+		   size_t n,
+		   size_t pos,
+		   double const *lat,
+		   double const *lon,
+		   int zone)
+{
+	while (pos < n && w->len < WINDOW_CAP) {
+		size_t m = n - pos < TRACK_BLOCK ? n - pos : TRACK_BLOCK;
+		if (m > WINDOW_CAP - w->len)
+			m = WINDOW_CAP - w->len;
+
+		size_t const base = w->len;
+
+		lat_lon_to_utm_batch(m,
+				     lat + pos,
+				     lon + pos,
+				     &zone,
+				     w->x + base,
+				     w->y + base,
+				     NULL);
+
+		for (size_t j = 0; j < m; ++j) {
+			size_t const k = base + j;
+
+			if (isnan(w->x[k]) || isnan(w->y[k]))
+				continue;
+
+			w->x[w->len] = w->x[k];
+			w->y[w->len] = w->y[k];
+			w->index[w->len] = pos + j;
+			++w->len;
+		}
+
+		pos += m;
+	}
+
+	return pos;
+}
+
+int utm_track_simplify(size_t n,
+		       double const *lat,
+		       double const *lon,
+		       int const *zone,
+		       double tolerance,
+		       double *easting,
+		       double *northing,
+		       size_t *index,
+		       size_t *count)
+{
+	if ((n && (!lat || !lon || !easting || !northing)) || !count ||
+	    (zone && (*zone < 1 || *zone > 60)) || !(tolerance >= 0.0))
+		return -1;
+
+	*count = 0;
+
+	/* Find the zone of the first point which can be converted. */
+	size_t pos = 0;
+	int zone_ = -1;
+
+	for (; pos < n && zone_ < 0; ++pos) {
+		double x, y;
+
+		lat_lon_to_utm_batch(1, lat + pos, lon + pos, zone, &x, &y,
+				     &zone_);
+	}
+
+	if (zone_ < 0)
+		return -1;
+	--pos;
+
+	struct window w;
+	struct output out = {easting, northing, index, 0};
+	double const tol2 = tolerance * tolerance;
+	int ret = -1;
+
+	w.len = 0;
+	w.x = malloc(WINDOW_CAP * sizeof *w.x);
+	w.y = malloc(WINDOW_CAP * sizeof *w.y);
+	w.index = malloc(WINDOW_CAP * sizeof *w.index);
+	w.keep = malloc(WINDOW_CAP);
+	w.stack = malloc(2 * WINDOW_CAP * sizeof *w.stack);
+	if (!w.x || !w.y || !w.index || !w.keep || !w.stack)
+		goto out;
+
+	pos = fill(&w, n, pos, lat, lon, zone_);
+	emit(&out, &w, 0);
+
+	for (;;) {
+		if (w.len < 2)
+			break;
+
+		simplify(&w, tol2);
+
+		if (pos == n) {
+			for (size_t i = 1; i < w.len; ++i)
+				if (w.keep[i])
+					emit(&out, &w, i);
+			break;
+		}
+
+		/* Flush up to the last retained vertex before the end of the
+		   window, whose position depends on the points to come.  If
+		   that would leave too little room for them, flush the end of
+		   the window as well. */
+		size_t last = w.len - 2;
+		while (!w.keep[last])
+			--last;
+
+		if (w.len - last > WINDOW_CAP / 2)
+			last = w.len - 1;
+
+		for (size_t i = 1; i <= last; ++i)
+			if (w.keep[i])
+				emit(&out, &w, i);
+
+		w.len -= last;
+		memmove(w.x, w.x + last, w.len * sizeof *w.x);
+		memmove(w.y, w.y + last, w.len * sizeof *w.y);
+		memmove(w.index, w.index + last, w.len * sizeof *w.index);
+
+		pos = fill(&w, n, pos, lat, lon, zone_);
+	}
+
+	*count = out.count;
+	ret = zone_;
+
+out:
+	free(w.x);
+	free(w.y);
+	free(w.index);
+	free(w.keep);
+	free(w.stack);
+
+	return ret;
+}
+
+struct fix {
+	double t, x, y;
+};
+
+struct resampler {
+	double t0, period;
+	int hermite;
+	size_t k; /* Index of the next sample */
+	size_t cap;
+	double *t, *x, *y;
+	size_t count;
+};
+
+// Velocity at b from its neighbours, either of which may be missing.
+static void velocity(struct fix const *a,
+		     struct fix const *b,
+		     struct fix const *c,
+		     double *vx,
+		     double *vy)
+{
+	if (!a)
+		a = b;
+	if (!c)
+		c = b;
+
+	double const dt = c->t - a->t;
+
+	*vx = (c->x - a->x) / dt;
+	*vy = (c->y - a->y) / dt;
+}
+
+// Emits the samples between the fixes a and b, with b itself if last.  The
+// neighbours prev and next, when present, give the velocities at a and b.
+static void interval(struct resampler *r,
+		     struct fix const *prev,
+		     struct fix const *a,
+		     struct fix const *b,
+		     struct fix const *next,
+		     int last)
+{
+	double const h = b->t - a->t;
+	double vax = 0.0, vay = 0.0, vbx = 0.0, vby = 0.0;
+
+	if (r->hermite) {
+		velocity(prev, a, b, &vax, &vay);
+		velocity(a, b, next, &vbx, &vby);
+	}
+
+	for (; r->count < r->cap; ++r->k) {
+		double const t = r->t0 + (double)r->k * r->period;
+
+		if (t > b->t || (t == b->t && !last))
+			break;
+
+		double const s = (t - a->t) / h;
+		double x, y;
+
+		if (r->hermite) {
+			double const s2 = s * s, s3 = s2 * s;
+			double const h00 = 2.0 * s3 - 3.0 * s2 + 1.0;
+			double const h10 = (s3 - 2.0 * s2 + s) * h;
+			double const h01 = -2.0 * s3 + 3.0 * s2;
+			double const h11 = (s3 - s2) * h;
+
+			x = h00 * a->x + h10 * vax + h01 * b->x + h11 * vbx;
+			y = h00 * a->y + h10 * vay + h01 * b->y + h11 * vby;
+		} else {
+			x = a->x + s * (b->x - a->x);
+			y = a->y + s * (b->y - a->y);
+		}
+
+		r->t[r->count] = t;
+		r->x[r->count] = x;
+		r->y[r->count] = y;
+		++r->count;
+	}
+}
+
+int utm_track_resample(size_t n,
+		       double const *t,
+		       double const *lat,
+		       double const *lon,
+		       int const *zone,
+		       double t0,
+		       double period,
+		       int flags,
+		       size_t cap,
+		       double *out_t,
+		       double *easting,
+		       double *northing,
+		       size_t *count)
+{
+	if ((n && (!t || !lat || !lon)) ||
+	    (cap && (!out_t || !easting || !northing)) || !count ||
+	    (zone && (*zone < 1 || *zone > 60)) || !(period > 0.0) ||
+	    !isfinite(t0))
+		return -1;
+
+	*count = 0;
+
+	/* Check the times first, so that nothing is written for a track which
+	   goes back in time. */
+	double last = -HUGE_VAL;
+
+	for (size_t i = 0; i < n; ++i) {
+		if (isnan(t[i]))
+			continue;
+		if (t[i] < last)
+			return -1;
+		last = t[i];
+	}
+
+	/* Find the zone of the first fix which can be converted. */
+	size_t pos = 0;
+	int zone_ = -1;
+
+	for (; pos < n && zone_ < 0; ++pos) {
+		double x, y;
+
+		if (isnan(t[pos]))
+			continue;
+		lat_lon_to_utm_batch(1, lat + pos, lon + pos, zone, &x, &y,
+				     &zone_);
+	}
+
+	if (zone_ < 0)
+		return -1;
+	--pos;
+
+	struct resampler r = {.t0 = t0,
+			      .period = period,
+			      .hermite = (flags & UTM_RESAMPLE_HERMITE) != 0,
+			      .cap = cap,
+			      .t = out_t,
+			      .x = easting,
+			      .y = northing};
+	double bx[TRACK_BLOCK], by[TRACK_BLOCK];
+	struct fix f[4]; /* The last fixes, newest last */
+	int nf = 0;
+
+	for (; pos < n && r.count < cap; pos += TRACK_BLOCK) {
+		size_t const m = n - pos < TRACK_BLOCK ? n - pos : TRACK_BLOCK;
+
+		lat_lon_to_utm_batch(
+		    m, lat + pos, lon + pos, &zone_, bx, by, NULL);
+
+		for (size_t j = 0; j < m && r.count < cap; ++j) {
+			double const tj = t[pos + j];
+
+			if (isnan(bx[j]) || isnan(by[j]) || isnan(tj))
+				continue;
+
+			if (nf) {
+				if (tj == f[nf - 1].t)
+					continue;
+			} else if (tj > t0) {
+				/* Skip the samples before the first fix. */
+				r.k = (size_t)ceil((tj - t0) / period);
+			}
+
+			if (nf == 4) {
+				memmove(f, f + 1, 3 * sizeof *f);
+				--nf;
+			}
+			f[nf++] = (struct fix){tj, bx[j], by[j]};
+
+			/* The interval before the last fix is emitted once
+			   the velocity at its end is known. */
+			if (nf == 3)
+				interval(&r, NULL, &f[0], &f[1], &f[2], 0);
+			else if (nf == 4)
+				interval(&r, &f[0], &f[1], &f[2], &f[3], 0);
+		}
+	}
+
+	if (nf == 1) {
+		if (cap && t0 + (double)r.k * period == f[0].t) {
+			out_t[0] = f[0].t;
+			easting[0] = f[0].x;
+			northing[0] = f[0].y;
+			r.count = 1;
+		}
+	} else if (nf == 2) {
+		interval(&r, NULL, &f[0], &f[1], NULL, 1);
+	} else if (nf >= 3) {
+		interval(&r, &f[nf - 3], &f[nf - 2], &f[nf - 1], NULL, 1);
+	}
+
+	*count = r.count;
+	return zone_;
+}
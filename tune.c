@@ -0,0 +1,377 @@
+// This file is part of utm.
+
+// (c) Copyright 2019 Miguel Aguiar.
+//
+// This program is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option) any
+// later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU Lesser General Public License for more details.
+
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#define _XOPEN_SOURCE 700
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "tune.h"
+#include "utm/sched.h"
+#include "utm/tune.h"
+#include "utm/utm.h"
+
+// First line of a configuration file.  It is followed by the lines
+// "kernel name", "threads n" and "grain n"; lines with other keys are
+// ignored.
+#define TUNE_MAGIC "utm-tune 1\n"
+
+// Points converted by each timing
+#define TUNE_POINTS ((size_t)1 << 17)
+
+// Timings of each alternative, of which the fastest is kept
+#define TUNE_REPS 3
+
+// Grain of the timings of the thread counts
+#define TUNE_GRAIN 4096
+
+// Factor by which an alternative must be faster to be preferred to a simpler
+// one: the series to the tables, which add a small error, and fewer threads
+// to more.
+#define TUNE_MARGIN 0.95
+
+static char const *const kernel_names[] = {"series", "tables"};
+
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+
+/* Read without a lock by the scheduler */
+static int tuned_threads;
+static size_t tuned_grain;
+
+// Returns the path of the configuration file, or null if there is none.
+static char const *default_path(char *buf, size_t size)
+{
+	char const *env = getenv("UTM_TUNE_FILE");
+	if (env)
+		return *env ? env : NULL;
+
+	char const *home = getenv("HOME");
+	if (!home || snprintf(buf, size, "%s/.utm-tune", home) >= (int)size)
+		return NULL;
+
+	return buf;
+}
+
+static int valid(struct utm_tune_config const *config)
+{
+	return (config->kernel == UTM_KERNEL_SERIES ||
+		config->kernel == UTM_KERNEL_TABLES) &&
+	       config->nthreads >= 0;
+}
+
+static void set_threads(struct utm_tune_config const *config)
+{
+	__atomic_store_n(&tuned_threads, config->nthreads, __ATOMIC_RELAXED);
+	__atomic_store_n(&tuned_grain, config->grain, __ATOMIC_RELAXED);
+}
+
+// Makes a loaded configuration the one in use, keeping a kernel chosen by the
+// application.
+static void use(struct utm_tune_config const *config)
+{
+	if (!utm_arc_tables_explicit())
+		utm_arc_tables_select(config->kernel == UTM_KERNEL_TABLES);
+	set_threads(config);
+}
+
+static void load_saved(void)
+{
+	struct utm_tune_config config;
+
+	if (!utm_tune_load(NULL, &config))
+		use(&config);
+}
+
+void utm_tune_init(void) { pthread_once(&init_once, load_saved); }
+
+int utm_tune_threads(void)
+{
+	return __atomic_load_n(&tuned_threads, __ATOMIC_RELAXED);
+}
+
+size_t utm_tune_grain(void)
+{
+	return __atomic_load_n(&tuned_grain, __ATOMIC_RELAXED);
+}
+
+int utm_tune_apply(struct utm_tune_config const *config)
+{
+	if (!config || !valid(config))
+		return -1;
+
+	utm_tune_init();
+	utm_set_arc_tables(config->kernel == UTM_KERNEL_TABLES);
+	set_threads(config);
+
+	return 0;
+}
+
+int utm_tune_use_saved(char const *path)
+{
+	struct utm_tune_config config;
+
+	if (utm_tune_load(path, &config))
+		return -1;
+
+	utm_tune_init();
+	use(&config);
+
+	return 0;
+}
+
+void utm_tune_current(struct utm_tune_config *config)
+{
+	if (!config)
+		return;
+
+	utm_tune_init();
+	config->kernel = utm_get_arc_tables();
+	config->nthreads = utm_tune_threads();
+	config->grain = utm_tune_grain();
+}
+
+char const *utm_tune_kernel(void)
+{
+	utm_tune_init();
+	return kernel_names[utm_get_arc_tables()];
+}
+
+int utm_tune_save(char const *path, struct utm_tune_config const *config)
+{
+	char buf[4096], tmp[4096 + 8];
+
+	if (!config || !valid(config))
+		return -1;
+	if (!path && !(path = default_path(buf, sizeof buf)))
+		return -1;
+	if (snprintf(tmp, sizeof tmp, "%s.tmp", path) >= (int)sizeof tmp)
+		return -1;
+
+	/* Write a copy and rename it, so that a reader never sees a partial
+	   file. */
+	FILE *f = fopen(tmp, "w");
+	if (!f)
+		return -1;
+
+	fprintf(f,
+		TUNE_MAGIC "kernel %s\nthreads %d\ngrain %zu\n",
+		kernel_names[config->kernel],
+		config->nthreads,
+		config->grain);
+
+	if (fclose(f) || rename(tmp, path)) {
+		unlink(tmp);
+		return -1;
+	}
+
+	return 0;
+}
+
+int utm_tune_load(char const *path, struct utm_tune_config *config)
+{
+	char buf[4096], line[256], name[16];
+	struct utm_tune_config c = {UTM_KERNEL_SERIES, 0, 0};
+	int ret = -1;
+
+	if (!config)
+		return -1;
+	if (!path && !(path = default_path(buf, sizeof buf)))
+		return -1;
+
+	FILE *f = fopen(path, "r");
+	if (!f)
+		return -1;
+
+	if (!fgets(line, sizeof line, f) || strcmp(line, TUNE_MAGIC))
+		goto out;
+
+	while (fgets(line, sizeof line, f)) {
+		if (sscanf(line, "kernel %15s", name) == 1) {
+			if (!strcmp(name, kernel_names[UTM_KERNEL_SERIES]))
+				c.kernel = UTM_KERNEL_SERIES;
+			else if (!strcmp(name, kernel_names[UTM_KERNEL_TABLES]))
+				c.kernel = UTM_KERNEL_TABLES;
+			else
+				goto out;
+		} else if (!strncmp(line, "threads ", 8)) {
+			if (sscanf(line + 8, "%d", &c.nthreads) != 1)
+				goto out;
+		} else if (!strncmp(line, "grain ", 6)) {
+			if (sscanf(line + 6, "%zu", &c.grain) != 1)
+				goto out;
+		}
+	}
+
+	if (ferror(f) || !valid(&c))
+		goto out;
+
+	*config = c;
+	ret = 0;
+
+out:
+	fclose(f);
+	return ret;
+}
+
+/* Timings */
+
+struct points {
+	double *lat, *lon, *x, *y;
+};
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + 1e-9 * (double)ts.tv_nsec;
+}
+
+// Best time of a forward and an inverse batch conversion of the points.
+static double time_kernel(struct points *p)
+{
+	double best = HUGE_VAL;
+
+	for (int r = 0; r < TUNE_REPS; ++r) {
+		double const t = now();
+
+		lat_lon_to_utm_batch(
+		    TUNE_POINTS, p->lat, p->lon, NULL, p->x, p->y, NULL);
+		utm_to_lat_lon_batch(
+		    TUNE_POINTS, p->x, p->y, 31, 0, p->lat, p->lon);
+
+		double const dt = now() - t;
+		best = dt < best ? dt : best;
+	}
+
+	return best;
+}
+
+// Best time of a forward conversion of the points on a scheduler.
+static double time_sched(struct points *p, struct utm_sched *s, size_t grain)
+{
+	struct utm_job const job = {
+	    0, TUNE_POINTS, p->lat, p->lon, p->x, p->y, NULL, 31, 0};
+	double best = HUGE_VAL;
+
+	for (int r = 0; r < TUNE_REPS; ++r) {
+		double const t = now();
+
+		if (utm_sched_convert(s, &job, 1, grain) < 0)
+			return -1.0;
+
+		double const dt = now() - t;
+		best = dt < best ? dt : best;
+	}
+
+	return best;
+}
+
+int utm_autotune(struct utm_tune_config *config)
+{
+	if (!config)
+		return -1;
+
+	utm_tune_init();
+
+	struct points p = {malloc(TUNE_POINTS * sizeof(double)),
+			   malloc(TUNE_POINTS * sizeof(double)),
+			   malloc(TUNE_POINTS * sizeof(double)),
+			   malloc(TUNE_POINTS * sizeof(double))};
+	struct utm_tune_config c = {UTM_KERNEL_SERIES, 1, 0};
+	int const tables = utm_get_arc_tables();
+	int ret = -1;
+
+	if (!p.lat || !p.lon || !p.x || !p.y)
+		goto out;
+
+	/* Points of zone 31, so that the inverse conversions are valid. */
+	for (size_t i = 0; i < TUNE_POINTS; ++i) {
+		p.lat[i] = -80.0 + 164.0 * (double)i / TUNE_POINTS;
+		p.lon[i] =
+		    6.0 * (double)((i * 7919) % TUNE_POINTS) / TUNE_POINTS;
+	}
+
+	utm_arc_tables_select(0);
+	double const series = time_kernel(&p);
+	utm_arc_tables_select(1);
+	double const table = time_kernel(&p);
+
+	if (table < TUNE_MARGIN * series)
+		c.kernel = UTM_KERNEL_TABLES;
+	utm_arc_tables_select(c.kernel == UTM_KERNEL_TABLES);
+
+	/* Powers of two up to the number of processors, and that number. */
+	long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	double best = HUGE_VAL;
+
+	if (ncpu < 1)
+		ncpu = 1;
+
+	for (long t = 1;; t *= 2) {
+		if (t > ncpu)
+			t = ncpu;
+
+		struct utm_sched *s = utm_sched_create((int)t);
+		if (!s)
+			goto out;
+
+		double const dt = time_sched(&p, s, TUNE_GRAIN);
+		utm_sched_destroy(s);
+		if (dt < 0.0)
+			goto out;
+
+		if (dt < TUNE_MARGIN * best) {
+			best = dt;
+			c.nthreads = (int)t;
+		}
+
+		if (t == ncpu)
+			break;
+	}
+
+	struct utm_sched *s = utm_sched_create(c.nthreads);
+	if (!s)
+		goto out;
+
+	best = HUGE_VAL;
+	for (size_t grain = 1024; grain <= 65536; grain *= 4) {
+		double const dt = time_sched(&p, s, grain);
+
+		if (dt >= 0.0 && dt < best) {
+			best = dt;
+			c.grain = grain;
+		}
+	}
+	utm_sched_destroy(s);
+
+	*config = c;
+	ret = 0;
+
+out:
+	utm_arc_tables_select(tables);
+	free(p.lat);
+	free(p.lon);
+	free(p.x);
+	free(p.y);
+
+	return ret;
+}
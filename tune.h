@@ -0,0 +1,40 @@
+// This file is part of utm.
+
+// (c) Copyright 2019 Miguel Aguiar.
+//
+// This program is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option) any
+// later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU Lesser General Public License for more details.
+
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+// Internal interface between the conversion routines and the tuning.
+
+#ifndef UTM_TUNE_INTERNAL_HEADER_GUARD_
+#define UTM_TUNE_INTERNAL_HEADER_GUARD_
+
+#include <stddef.h>
+
+// Loads the saved configuration, the first time it is called.
+void utm_tune_init(void);
+
+// Selects the kernel of the batch conversions for the tuning, without
+// marking it as chosen by the application.
+void utm_arc_tables_select(int enable);
+
+// Returns 1 if the application chose the kernel with utm_set_arc_tables.
+int utm_arc_tables_explicit(void);
+
+// Number of workers and grain of the configuration in use, or zero for the
+// built-in defaults.
+int utm_tune_threads(void);
+size_t utm_tune_grain(void);
+
+#endif
@@ -0,0 +1,126 @@
+// This file is part of utm.
+
+// (c) Copyright 2019 Miguel Aguiar.
+//
+// This program is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option) any
+// later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU Lesser General Public License for more details.
+
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#define _DEFAULT_SOURCE
+#include <fcntl.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "utm/velocity.h"
+
+struct utm_velocity_grid {
+	void *map;
+	size_t bytes;
+	struct utm_velocity_header const *header;
+	double const *nodes; /* ve, vn per node */
+};
+
+struct utm_velocity_grid *utm_velocity_grid_open(char const *path)
+{
+	if (!path)
+		return NULL;
+
+	int const fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	struct stat st;
+	void *map = MAP_FAILED;
+
+	if (!fstat(fd, &st) &&
+	    (size_t)st.st_size >= sizeof(struct utm_velocity_header))
+		map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd,
+			   0);
+	close(fd);
+
+	if (map == MAP_FAILED)
+		return NULL;
+
+	struct utm_velocity_header const *h = map;
+	size_t const bytes = (size_t)st.st_size;
+	size_t const nodes = (size_t)h->nlat * h->nlon;
+
+	if (memcmp(h->magic, UTM_VELOCITY_MAGIC, sizeof h->magic) ||
+	    h->nlat < 2 || h->nlon < 2 || !isfinite(h->lat0) ||
+	    !isfinite(h->lon0) || !(h->dlat > 0.0) || !(h->dlon > 0.0) ||
+	    (bytes - sizeof *h) / (2 * sizeof(double)) < nodes) {
+		munmap(map, bytes);
+		return NULL;
+	}
+
+	struct utm_velocity_grid *grid = malloc(sizeof *grid);
+	if (!grid) {
+		munmap(map, bytes);
+		return NULL;
+	}
+
+	grid->map = map;
+	grid->bytes = bytes;
+	grid->header = h;
+	grid->nodes = (double const *)(h + 1);
+
+	return grid;
+}
+
+void utm_velocity_grid_close(struct utm_velocity_grid *grid)
+{
+	if (!grid)
+		return;
+
+	munmap(grid->map, grid->bytes);
+	free(grid);
+}
+
+int utm_velocity_grid_at(struct utm_velocity_grid const *grid,
+			 double lat,
+			 double lon,
+			 double *ve,
+			 double *vn)
+{
+	if (!grid || !ve || !vn)
+		return -1;
+
+	struct utm_velocity_header const *h = grid->header;
+	double const u = (lat - h->lat0) / h->dlat;
+	/* Longitudes are taken eastwards from the western edge. */
+	lon -= 360.0 * floor((lon - h->lon0) / 360.0);
+	double const v = (lon - h->lon0) / h->dlon;
+
+	/* Also rejects NaN. */
+	if (!(u >= 0.0 && u <= h->nlat - 1) || !(v >= 0.0 && v <= h->nlon - 1))
+		return -1;
+
+	/* The cell of the point; the last row and column belong to the cells
+	   before them. */
+	size_t const i = u < h->nlat - 1 ? (size_t)u : h->nlat - 2;
+	size_t const j = v < h->nlon - 1 ? (size_t)v : h->nlon - 2;
+	double const fu = u - (double)i, fv = v - (double)j;
+
+	double const *sw = grid->nodes + 2 * (i * h->nlon + j);
+	double const *nw = sw + 2 * h->nlon;
+	double const w00 = (1.0 - fu) * (1.0 - fv), w01 = (1.0 - fu) * fv;
+	double const w10 = fu * (1.0 - fv), w11 = fu * fv;
+
+	*ve = w00 * sw[0] + w01 * sw[2] + w10 * nw[0] + w11 * nw[2];
+	*vn = w00 * sw[1] + w01 * sw[3] + w10 * nw[1] + w11 * nw[3];
+
+	return 0;
+}